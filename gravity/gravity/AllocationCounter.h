@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace gravity
+{
+	//
+	// Number of the heap allocations of the whole process. It only counts when the build defines COUNT_ALLOCATIONS,
+	// which replaces the global operators new and delete, the aligned ones too (see gravity.cpp), otherwise it stays at 0
+	//
+	class allocation_counter
+	{
+		static inline std::atomic<uint64_t> _count{ 0 };
+
+	public:
+#if defined(COUNT_ALLOCATIONS)
+		static constexpr bool enabled{ true };
+#else
+		static constexpr bool enabled{ false };
+#endif
+
+		static inline void on_allocation() noexcept
+		{
+			_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		static inline uint64_t count() noexcept
+		{
+			return _count.load(std::memory_order_relaxed);
+		}
+	};
+}
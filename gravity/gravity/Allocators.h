@@ -2,8 +2,13 @@
 
 #ifdef _WIN32
 #include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
 #endif
 #include <cstdint>
+#include <cstdlib>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -152,3 +157,151 @@ using avx_aligned = aligned_allocator<T, 32>;
 
 template<typename T>
 using cache_aligned = aligned_allocator<T, 64>;
+
+//
+// How the per-body arrays get their memory, see body_allocator. Set once at startup, before any body is allocated,
+// as the arrays are freed the way the policy at the time says.
+//
+// huge_pages - the arrays of 2 MB and more are on huge pages: transparent huge pages requested by madvise on Linux,
+// large pages on Windows when the process holds SeLockMemoryPrivilege, normal pages otherwise.
+// first_touch - the pages of the arrays are first written by the worker threads that own their slices, so that
+// they land on the NUMA node of that thread (see gravity_struct::place_body_arrays)
+//
+class body_memory
+{
+	static inline bool _huge_pages{ false };
+	static inline bool _first_touch{ false };
+
+public:
+	static constexpr std::size_t HUGE_PAGE_SIZE{ 2 * 1024 * 1024 };
+
+	static void configure(bool huge_pages, bool first_touch) noexcept
+	{
+		_huge_pages = huge_pages;
+		_first_touch = first_touch;
+	}
+
+	static inline bool huge_pages() noexcept
+	{
+		return _huge_pages;
+	}
+
+	static inline bool first_touch() noexcept
+	{
+		return _first_touch;
+	}
+
+	static std::string describe()
+	{
+		std::string ret{ "body memory: " };
+		ret += _huge_pages ? "2 MB huge pages for the arrays of 2 MB and more" : "normal pages";
+		ret += _first_touch ? ", first touch by the owning worker threads" : ", first touch by the allocating thread";
+		return ret;
+	}
+
+	static inline bool on_huge_pages(std::size_t bytes) noexcept
+	{
+		return _huge_pages && bytes >= HUGE_PAGE_SIZE;
+	}
+
+	static void* allocate_huge(std::size_t bytes)
+	{
+		bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+#ifdef _WIN32
+		const SIZE_T large_page{ GetLargePageMinimum() };
+
+		void* p{ nullptr };
+		if (large_page != 0)
+		{
+			p = VirtualAlloc(nullptr, (bytes + large_page - 1) / large_page * large_page, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		}
+
+		if (p == nullptr)
+		{
+			p = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		}
+
+		return p;
+#else
+		void* p{ nullptr };
+		if (posix_memalign(&p, HUGE_PAGE_SIZE, bytes) != 0)
+			return nullptr;
+
+		// only a hint, the kernel may not have the huge pages or may not use them
+		madvise(p, bytes, MADV_HUGEPAGE);
+
+		return p;
+#endif
+	}
+
+	static void free_huge(void* p) noexcept
+	{
+#ifdef _WIN32
+		VirtualFree(p, 0, MEM_RELEASE);
+#else
+		free(p);
+#endif
+	}
+};
+
+//
+// Cache aligned allocator of the per-body arrays, following body_memory
+//
+template <typename T>
+class body_allocator
+{
+public:
+	typedef T value_type;
+
+	body_allocator() noexcept { }
+
+	template <typename U> body_allocator(const body_allocator<U>&) noexcept { }
+
+	T* allocate(const std::size_t n) const
+	{
+		if (n == 0) {
+			return NULL;
+		}
+
+		if (n > (static_cast<std::size_t>(0) - static_cast<std::size_t>(1)) / sizeof(T))
+		{
+			throw std::length_error("body_allocator<T>::allocate() - Integer overflow.");
+		}
+
+		const std::size_t bytes{ n * sizeof(T) };
+
+		void* const pv = body_memory::on_huge_pages(bytes) ? body_memory::allocate_huge(bytes) : _mm_malloc(bytes, 64);
+
+		if (pv == NULL)
+		{
+			throw std::bad_alloc();
+		}
+
+		return static_cast<T*>(pv);
+	}
+
+	void deallocate(T* const p, const std::size_t n) const noexcept
+	{
+		if (body_memory::on_huge_pages(n * sizeof(T)))
+		{
+			body_memory::free_huge(p);
+		}
+		else
+		{
+			_mm_free(p);
+		}
+	}
+
+	template <typename U>
+	bool operator==(const body_allocator<U>&) const noexcept
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const body_allocator<U>&) const noexcept
+	{
+		return false;
+	}
+};
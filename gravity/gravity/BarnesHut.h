@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+#include "Octree.h"
+
+namespace gravity
+{
+	//
+	// Barnes-Hut force engine: the octree is rebuilt from scratch every step, monopoles (and optionally the
+	// quadrupoles) are computed bottom-up, and every body then walks the tree on its own, so the walks can run
+	// in parallel
+	//
+	class barnes_hut_tree
+	{
+		octree _tree;
+
+		// traceless quadrupole moment of each node around its com, in mass_G units: xx, yy, zz, xy, xz, yz
+		std::vector<std::array<double, 6>> _quad;
+
+		double _theta{ 0.5 };
+		bool _quadrupole{ false };
+
+	public:
+		void set_opening_angle(double theta) noexcept
+		{
+			_theta = theta;
+		}
+
+		void set_quadrupole(bool quadrupole) noexcept
+		{
+			_quadrupole = quadrupole;
+		}
+
+		inline int size() const noexcept
+		{
+			return _tree.size();
+		}
+
+		// body index of the k-th body in the tree order
+		inline int body_at(int k) const noexcept
+		{
+			return _tree.body_at(k);
+		}
+
+		void build(const body_generation& generation, const body_properties& props)
+		{
+			_tree.build(generation, props);
+
+			if (_quadrupole)
+			{
+				compute_quadrupoles();
+			}
+		}
+
+		//
+		// Acceleration of the k-th body (in the tree order). Cells are accepted when size / distance < theta,
+		// cells containing the body itself are always opened. Bodies within the opened leaves are summed directly
+		//
+		template <typename TOnCollision, typename TOnTidalHeating>
+		vec3d_pd acceleration(int k, TOnCollision&& on_collision, TOnTidalHeating&& on_tidal_heating) const noexcept
+		{
+			const auto& nodes{ _tree.nodes() };
+			const vec3d_pd loc{ _tree.location(k) };
+			const double theta2{ _theta * _theta };
+
+			vec3d_pd acc{ 0.0, 0.0, 0.0 };
+
+			const int num_nodes{ static_cast<int>(nodes.size()) };
+
+			int n = 0;
+			while (n < num_nodes)
+			{
+				const auto& nd{ nodes[n] };
+
+				if (nd.leaf)
+				{
+					acc += _tree.leaf_pull(k, nd, on_collision, on_tidal_heating);
+					n = nd.next;
+					continue;
+				}
+
+				const auto r_ba{ nd.com - loc };
+				const double r2{ vec3d_pd::dot(r_ba, r_ba) };
+				const double size{ nd.half_size * 2.0 };
+
+				if (size * size < theta2 * r2 && !octree::contains(nd, loc))
+				{
+					const double r_modulo{ std::sqrt(r2) };
+					const double inv_r3{ 1.0 / (r2 * r_modulo) };
+
+					acc += r_ba * (nd.mass_G * inv_r3);
+
+					if (_quadrupole)
+					{
+						acc += quadrupole_acceleration(_quad[n], -r_ba, r2, inv_r3);
+					}
+
+					n = nd.next;
+				}
+				else
+				{
+					n = n + 1;
+				}
+			}
+
+			return acc;
+		}
+
+	private:
+		//
+		// r is the vector from the node's centre of mass to the body:
+		// a = Q r / r^5 - 5/2 (r Q r) r / r^7
+		//
+		static vec3d_pd quadrupole_acceleration(const std::array<double, 6>& q, const vec3d_pd& r, double r2, double inv_r3) noexcept
+		{
+			const vec3d_pd q_r{
+				q[0] * r.x() + q[3] * r.y() + q[4] * r.z(),
+				q[3] * r.x() + q[1] * r.y() + q[5] * r.z(),
+				q[4] * r.x() + q[5] * r.y() + q[2] * r.z()
+			};
+
+			const double inv_r5{ inv_r3 / r2 };
+			const double r_q_r{ vec3d_pd::dot(r, q_r) };
+
+			return q_r * inv_r5 - r * (2.5 * r_q_r * inv_r5 / r2);
+		}
+
+		static void add_quadrupole(std::array<double, 6>& q, double m, const vec3d_pd& d) noexcept
+		{
+			const double d2{ vec3d_pd::dot(d, d) };
+
+			q[0] += m * (3 * d.x() * d.x() - d2);
+			q[1] += m * (3 * d.y() * d.y() - d2);
+			q[2] += m * (3 * d.z() * d.z() - d2);
+			q[3] += m * 3 * d.x() * d.y();
+			q[4] += m * 3 * d.x() * d.z();
+			q[5] += m * 3 * d.y() * d.z();
+		}
+
+		//
+		// Bottom-up pass: leaves sum their bodies, inner nodes combine their children (parallel axis theorem)
+		//
+		void compute_quadrupoles()
+		{
+			const auto& nodes{ _tree.nodes() };
+
+			_quad.resize(nodes.size());
+
+			for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n)
+			{
+				const auto& nd{ nodes[n] };
+				auto& q{ _quad[n] };
+
+				q = {};
+
+				if (nd.leaf)
+				{
+					for (int k = nd.begin; k < nd.end; ++k)
+					{
+						add_quadrupole(q, _tree.mass_G(k), _tree.location(k) - nd.com);
+					}
+				}
+				else
+				{
+					for (int child = n + 1; child < nd.next; child = nodes[child].next)
+					{
+						add_quadrupole(q, nodes[child].mass_G, nodes[child].com - nd.com);
+
+						for (int c = 0; c < 6; ++c)
+						{
+							q[c] += _quad[child][c];
+						}
+					}
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "WorldObjects.h"
+#include "EnsembleKernel.h"
+#include "WorkStealingPool.h"
+
+namespace gravity
+{
+	//
+	// Settings shared by all the runs of a batch, as given on the command line
+	//
+	struct batch_settings
+	{
+		double time_delta{ 1.0 };
+		double tolerance{ 1e-12 };
+		int respa_substeps{ 8 };
+		double respa_cutoff{ 0.0 };
+		int collision_interval{ 1 };
+		uint64_t max_iterations{ 0 };
+		uint64_t report_every_n{ 0 };
+		std::string report_centre{};
+
+		force_kernel kernel{ force_kernel::scalar };
+		force_engine engine{ force_engine::direct };
+		double tree_opening_angle{ 0.5 };
+		bool tree_quadrupole{ false };
+		int fmm_order{ 4 };
+		tile_shape tiles{};
+
+		// step ENSEMBLE_WIDTH runs of a scenario together in one ensemble_struct (direct engine only)
+		bool ensemble{ false };
+	};
+
+	//
+	// One line of the batch manifest: the input csv, where to report to, and how many perturbed copies to run.
+	//
+	// Each run adds normal noise of the given sigma to every body's location (km) and velocity (km/s) per axis,
+	// and scales the masses by 1 + N(0, mass_sigma). The noise of run k only depends on (seed, k), so any single run
+	// can be reproduced on its own. Relative paths are relative to the manifest
+	//
+	struct batch_scenario
+	{
+		std::string name{};
+		std::string input_file{};
+		std::string output_file{};
+
+		int runs{ 1 };
+		uint64_t seed{ 0 };
+
+		double location_sigma_km{ 0.0 };
+		double velocity_sigma_kms{ 0.0 };
+		double mass_sigma{ 0.0 };
+
+		// parsed input
+		uint64_t epoch_millis{ 0 };
+		std::vector<mass_body> bodies{};
+
+		static std::string get_csv_header()
+		{
+			return "name,input,output,runs,seed,location_sigma_km,velocity_sigma_kms,mass_sigma";
+		}
+
+		bool from_csv_line(const std::string& line)
+		{
+			std::istringstream str{ line };
+
+			std::string runs_str, seed_str, location_sigma_str, velocity_sigma_str, mass_sigma_str;
+
+			if (!std::getline(str, name, ',') ||
+				!std::getline(str, input_file, ',') ||
+				!std::getline(str, output_file, ',') ||
+				!std::getline(str, runs_str, ',') ||
+				!std::getline(str, seed_str, ',') ||
+				!std::getline(str, location_sigma_str, ',') ||
+				!std::getline(str, velocity_sigma_str, ',') ||
+				!std::getline(str, mass_sigma_str, ',')
+				)
+			{
+				return false;
+			}
+
+			try
+			{
+				runs = std::stoi(runs_str);
+				seed = std::stoull(seed_str);
+				location_sigma_km = std::stod(location_sigma_str);
+				velocity_sigma_kms = std::stod(velocity_sigma_str);
+				mass_sigma = std::stod(mass_sigma_str);
+			}
+			catch (const std::exception&)
+			{
+				return false;
+			}
+
+			return runs > 0 && !input_file.empty() && !output_file.empty();
+		}
+
+		bool load_input()
+		{
+			std::ifstream istrm(input_file);
+
+			std::string csv_header;
+
+			if (!std::getline(istrm, csv_header))
+				return false;
+
+			if (csv_header != mass_body::get_csv_header())
+				return false;
+
+			bodies.clear();
+
+			std::string line;
+			while (std::getline(istrm, line))
+			{
+				mass_body body;
+				if (!body.from_csv_line(line, epoch_millis))
+					return false;
+
+				bodies.push_back(body);
+			}
+
+			return true;
+		}
+
+		// bodies of the given run, with the noise applied
+		std::vector<mass_body> perturbed_bodies(int run) const
+		{
+			std::seed_seq seed{
+				static_cast<uint32_t>(this->seed),
+				static_cast<uint32_t>(this->seed >> 32),
+				static_cast<uint32_t>(run)
+			};
+			std::mt19937_64 generator{ seed };
+			std::normal_distribution<double> noise{ 0.0, 1.0 };
+
+			std::vector<mass_body> result{ bodies };
+
+			for (auto& body : result)
+			{
+				const vec3d_pd location_noise{ noise(generator), noise(generator), noise(generator) };
+				const vec3d_pd velocity_noise{ noise(generator), noise(generator), noise(generator) };
+
+				body.location = acc3d{ body.location.value + location_noise * (location_sigma_km * 1000.0) };  // to meters
+				body.velocity = acc3d{ body.velocity.value + velocity_noise * (velocity_sigma_kms * 1000.0) }; // to meters / s
+				body.mass *= std::max(0.0, 1.0 + noise(generator) * mass_sigma);
+			}
+
+			return result;
+		}
+
+		// report file of the given run, "out.csv" becomes "out_17.csv" when there is more than one run
+		std::string run_output_file(int run) const
+		{
+			if (runs == 1)
+				return output_file;
+
+			std::filesystem::path path{ output_file };
+			return (path.parent_path() / (path.stem().string() + "_" + std::to_string(run) + path.extension().string())).string();
+		}
+
+		// where an ensemble run that ran into a collision says so, "out_17.csv" becomes "out_17.collided.csv"
+		std::string run_collision_file(int run) const
+		{
+			std::filesystem::path path{ run_output_file(run) };
+			return (path.parent_path() / (path.stem().string() + ".collided" + path.extension().string())).string();
+		}
+	};
+
+	//
+	// Runs all the scenarios of a manifest over a shared pool, one run per task. Each run is an independent
+	// single threaded gravity_struct, so the throughput scales with the cores instead of being capped by the
+	// per-step synchronisation of a small world.
+	//
+	// With batch_settings::ensemble the runs of a scenario are packed ENSEMBLE_WIDTH per task into the SIMD lanes
+	// of an ensemble_struct instead, see EnsembleKernel.h for what it does differently on collisions
+	//
+	template <integration_method method>
+	class batch_runner
+	{
+		batch_settings _settings;
+		std::vector<batch_scenario> _scenarios;
+
+		work_stealing_pool _pool;
+
+		struct run_ref
+		{
+			int scenario;
+			int run;
+		};
+
+	public:
+		explicit batch_runner(int num_worker_threads)
+			: _pool{ num_worker_threads }
+		{
+		}
+
+		void set_settings(const batch_settings& settings)
+		{
+			_settings = settings;
+		}
+
+		//
+		// Parses the manifest and all of its inputs, reports the first broken line to the errors stream
+		//
+		bool load_manifest(const std::string& manifest_file, std::ostream& errors)
+		{
+			std::ifstream istrm(manifest_file);
+
+			std::string csv_header;
+
+			if (!std::getline(istrm, csv_header) || csv_header != batch_scenario::get_csv_header())
+			{
+				errors << manifest_file << ": expected header " << batch_scenario::get_csv_header() << std::endl;
+				return false;
+			}
+
+			const auto base_dir{ std::filesystem::path{ manifest_file }.parent_path() };
+
+			auto resolve = [&](const std::string& file)
+			{
+				std::filesystem::path path{ file };
+				return path.is_relative() ? (base_dir / path).string() : file;
+			};
+
+			_scenarios.clear();
+
+			std::string line;
+			for (int line_no = 2; std::getline(istrm, line); ++line_no)
+			{
+				if (line.empty() || line[0] == '#')
+					continue;
+
+				batch_scenario scenario;
+
+				if (!scenario.from_csv_line(line))
+				{
+					errors << manifest_file << "(" << line_no << "): invalid scenario" << std::endl;
+					return false;
+				}
+
+				scenario.input_file = resolve(scenario.input_file);
+				scenario.output_file = resolve(scenario.output_file);
+
+				if (!scenario.load_input())
+				{
+					errors << manifest_file << "(" << line_no << "): failed to parse " << scenario.input_file << std::endl;
+					return false;
+				}
+
+				_scenarios.push_back(std::move(scenario));
+			}
+
+			return true;
+		}
+
+		inline const std::vector<batch_scenario>& scenarios() const noexcept
+		{
+			return _scenarios;
+		}
+
+		int num_runs() const noexcept
+		{
+			int num_runs{ 0 };
+			for (const auto& scenario : _scenarios)
+			{
+				num_runs += scenario.runs;
+			}
+			return num_runs;
+		}
+
+		void run()
+		{
+			std::vector<run_ref> runs;
+			runs.reserve(num_runs());
+
+			// in ensemble mode a task is ENSEMBLE_WIDTH consecutive runs of a scenario, starting at run
+			const int runs_per_task{ _settings.ensemble && !uses_kick_drift(method) ? ENSEMBLE_WIDTH : 1 };
+
+			for (int s = 0; s < static_cast<int>(_scenarios.size()); ++s)
+			{
+				for (int r = 0; r < _scenarios[s].runs; r += runs_per_task)
+				{
+					runs.push_back({ s, r });
+				}
+			}
+
+			_pool.parallel_for(0, static_cast<int>(runs.size()), 1,
+				[&](int k)
+				{
+					if constexpr (!uses_kick_drift(method))
+					{
+						if (_settings.ensemble)
+						{
+							run_ensemble(_scenarios[runs[k].scenario], runs[k].run);
+							return;
+						}
+					}
+
+					run_one(_scenarios[runs[k].scenario], runs[k].run);
+				});
+		}
+
+	private:
+		void run_one(const batch_scenario& scenario, int run)
+		{
+			gravity_struct<method> objects{ 1 };
+
+			objects.set_time_delta(_settings.time_delta);
+			objects.set_tolerance(_settings.tolerance);
+			objects.set_force_split(_settings.respa_substeps, _settings.respa_cutoff);
+			objects.set_collision_interval(_settings.collision_interval);
+			objects.set_force_kernel(_settings.kernel);
+			objects.set_force_engine(_settings.engine);
+			objects.set_tree_opening_angle(_settings.tree_opening_angle);
+			objects.set_tree_quadrupole(_settings.tree_quadrupole);
+			objects.set_fmm_order(_settings.fmm_order);
+			objects.set_tile_shape(_settings.tiles);
+			objects.set_report_centre(_settings.report_centre);
+			objects.set_report_every(_settings.report_every_n);
+			objects.set_max_iterations(_settings.max_iterations);
+
+			const auto output_file{ scenario.run_output_file(run) };
+
+			std::ofstream{ output_file, std::ios::trunc };
+			objects.set_output_csv(output_file);
+
+			for (const auto& body : scenario.perturbed_bodies(run))
+			{
+				objects.register_body(body);
+			}
+
+			objects.set_simulation_start_in_epoch_time_millis(scenario.epoch_millis);
+
+			while (objects.iterate())
+			{
+			}
+		}
+
+		//
+		// Runs [first_run, first_run + ENSEMBLE_WIDTH) of the scenario in lock step, a short last group is padded
+		// with copies of its last run, which are not reported
+		//
+		void run_ensemble(const batch_scenario& scenario, int first_run)
+		{
+			ensemble_struct<method> ensemble;
+
+			ensemble.set_time_delta(_settings.time_delta);
+			ensemble.set_report_centre(_settings.report_centre);
+			ensemble.set_report_every(_settings.report_every_n);
+			ensemble.set_max_iterations(_settings.max_iterations);
+
+			const int num_lanes{ std::min(ENSEMBLE_WIDTH, scenario.runs - first_run) };
+
+			for (int k = 0; k < num_lanes; ++k)
+			{
+				const auto output_file{ scenario.run_output_file(first_run + k) };
+
+				std::ofstream{ output_file, std::ios::trunc };
+				ensemble.set_output_csv(k, output_file);
+
+				ensemble.set_lane(k, scenario.perturbed_bodies(first_run + k));
+			}
+
+			ensemble.set_simulation_start_in_epoch_time_millis(scenario.epoch_millis);
+
+			while (ensemble.iterate())
+			{
+			}
+
+			// the reports of a collided run stop before its collision, this tells it from a run that is complete
+			for (int k = 0; k < num_lanes; ++k)
+			{
+				const auto collided_at{ ensemble.collided_at(k) };
+
+				std::error_code ignored;
+				std::filesystem::remove(scenario.run_collision_file(first_run + k), ignored);
+
+				if (collided_at == ensemble_struct<method>::NOT_COLLIDED)
+					continue;
+
+				std::ofstream ostrm(scenario.run_collision_file(first_run + k), std::ios::trunc);
+
+				ostrm << "iteration,epoch_millis\n"
+					<< collided_at << "," << ensemble.epoch_millis_at(collided_at) << "\n";
+			}
+		}
+	};
+}
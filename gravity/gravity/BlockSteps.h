@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+
+namespace gravity
+{
+	//
+	// Power of two block timesteps (Aarseth): body i steps by time_delta / 2^level[i]. The steps of all the levels
+	// line up, so at any time the bodies due form a block that is stepped together, while the rest are only
+	// predicted to that time to pull on them
+	//
+	struct block_steps
+	{
+		static constexpr int MAX_LEVEL{ 24 };
+		static constexpr uint64_t TICKS{ uint64_t{ 1 } << MAX_LEVEL };		// per time_delta
+
+		std::vector<int> level;
+		std::vector<uint64_t> time;			// ticks since the start of the current time_delta
+		std::vector<vec3d_pd> jerk;			// derivative of the acceleration at time
+
+		// predicted velocities at the block time, for the jerk of hermite4
+		hot_vector<double> vx;
+		hot_vector<double> vy;
+		hot_vector<double> vz;
+
+		inline size_t size() const noexcept
+		{
+			return level.size();
+		}
+
+		void resize(size_t n)
+		{
+			level.assign(n, 0);
+			time.assign(n, 0);
+			jerk.assign(n, { 0.0, 0.0, 0.0 });
+			vx.assign(n, 0.0);
+			vy.assign(n, 0.0);
+			vz.assign(n, 0.0);
+		}
+
+		static inline uint64_t ticks(int level) noexcept
+		{
+			return TICKS >> level;
+		}
+
+		//
+		// Level of the longest step that is not above dt
+		//
+		static int level_for(double dt, double time_delta) noexcept
+		{
+			if (std::isnan(dt) || dt >= time_delta)
+				return 0;
+
+			if (dt <= 0.0)
+				return MAX_LEVEL;
+
+			return std::clamp(static_cast<int>(std::ceil(std::log2(time_delta / dt))), 0, MAX_LEVEL);
+		}
+
+		//
+		// The step can shrink at any time, but it only grows a level at a time, and only where the longer step
+		// lines up with the block structure
+		//
+		static int next_level(int current, int desired, uint64_t time) noexcept
+		{
+			if (desired >= current)
+				return desired;
+
+			if (current > 0 && time % ticks(current - 1) == 0)
+				return current - 1;
+
+			return current;
+		}
+	};
+
+	//
+	// Pull of all the bodies onto the body i, and the nearest of them for the step criteria
+	//
+	struct block_pull
+	{
+		vec3d_pd acc{ 0.0, 0.0, 0.0 };
+
+		int nearest{ -1 };
+		double nearest_r2{ std::numeric_limits<double>::infinity() };
+	};
+
+	//
+	// Pull onto a single active body from the (predicted) locations of all the others, so the work of a block is
+	// proportional to the number of the bodies in it. on_collision(i, j) and on_tidal_heating(i) are called as in the
+	// other kernels
+	//
+	template <typename TOnCollision, typename TOnTidalHeating>
+	inline block_pull block_active_pull(
+		int i,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* mass_G,
+		const double* radius,
+		TOnCollision&& on_collision,
+		TOnTidalHeating&& on_tidal_heating
+	) noexcept
+	{
+		block_pull pull;
+
+		const double xi{ x[i] };
+		const double yi{ y[i] };
+		const double zi{ z[i] };
+		const double ri{ radius[i] };
+		const double tidal_r{ ri * 10.0 };
+
+		double sx{ 0.0 };
+		double sy{ 0.0 };
+		double sz{ 0.0 };
+
+		bool heat{ false };
+
+		for (int j = 0; j < num_bodies; ++j)
+		{
+			if (j == i)
+				continue;
+
+			const double dx{ x[j] - xi };
+			const double dy{ y[j] - yi };
+			const double dz{ z[j] - zi };
+
+			const double r2{ dx * dx + dy * dy + dz * dz };
+			const double r{ std::sqrt(r2) };
+
+			if (r2 < pull.nearest_r2)
+			{
+				pull.nearest_r2 = r2;
+				pull.nearest = j;
+			}
+
+			if (r > ri + radius[j])
+			{
+				const double s{ mass_G[j] / (r2 * r) };
+
+				sx += dx * s;
+				sy += dy * s;
+				sz += dz * s;
+
+				heat |= r < tidal_r;
+			}
+			else
+			{
+				on_collision(i, j);
+			}
+		}
+
+		if (heat)
+		{
+			on_tidal_heating(i);
+		}
+
+		pull.acc = { sx, sy, sz };
+		return pull;
+	}
+
+	//
+	// Acceleration and its time derivative (the jerk) of a single body, as needed by the Hermite scheme
+	//
+	struct hermite_pull
+	{
+		vec3d_pd acc{ 0.0, 0.0, 0.0 };
+		vec3d_pd jerk{ 0.0, 0.0, 0.0 };
+	};
+
+	//
+	// Fused acceleration and jerk of the body i from the (predicted) locations and velocities of all the others.
+	//
+	// The pairs are summed in HERMITE_LANES independent partial sums with no branches, so the compiler can keep them
+	// in vector registers: the body itself and the colliding pairs are masked out by their zero 1/r, and the collisions
+	// are only looked up in a second pass when there are any
+	//
+	static constexpr int HERMITE_LANES{ 4 };
+
+	template <typename TOnCollision, typename TOnTidalHeating>
+	inline hermite_pull hermite_active_pull(
+		int i,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* vx,
+		const double* vy,
+		const double* vz,
+		const double* mass_G,
+		const double* radius,
+		TOnCollision&& on_collision,
+		TOnTidalHeating&& on_tidal_heating
+	) noexcept
+	{
+		const double xi{ x[i] };
+		const double yi{ y[i] };
+		const double zi{ z[i] };
+		const double vxi{ vx[i] };
+		const double vyi{ vy[i] };
+		const double vzi{ vz[i] };
+		const double ri{ radius[i] };
+		const double tidal_r{ ri * 10.0 };
+
+		double ax[HERMITE_LANES]{};
+		double ay[HERMITE_LANES]{};
+		double az[HERMITE_LANES]{};
+		double jx[HERMITE_LANES]{};
+		double jy[HERMITE_LANES]{};
+		double jz[HERMITE_LANES]{};
+		int contact[HERMITE_LANES]{};
+		int heat[HERMITE_LANES]{};
+
+		auto pair = [&](int j, int lane) noexcept
+		{
+			const double dx{ x[j] - xi };
+			const double dy{ y[j] - yi };
+			const double dz{ z[j] - zi };
+			const double dvx{ vx[j] - vxi };
+			const double dvy{ vy[j] - vyi };
+			const double dvz{ vz[j] - vzi };
+
+			const double r2{ dx * dx + dy * dy + dz * dz };
+			const double r{ std::sqrt(r2) };
+			const bool live{ r > ri + radius[j] };
+
+			const double inv_r{ live ? 1.0 / r : 0.0 };
+			const double inv_r2{ inv_r * inv_r };
+			const double s{ mass_G[j] * inv_r * inv_r2 };
+			const double rv{ 3.0 * (dx * dvx + dy * dvy + dz * dvz) * inv_r2 };
+
+			ax[lane] += dx * s;
+			ay[lane] += dy * s;
+			az[lane] += dz * s;
+
+			jx[lane] += (dvx - dx * rv) * s;
+			jy[lane] += (dvy - dy * rv) * s;
+			jz[lane] += (dvz - dz * rv) * s;
+
+			contact[lane] |= !live & (j != i);
+			heat[lane] |= live & (r < tidal_r);
+		};
+
+		int j = 0;
+		for (; j + HERMITE_LANES <= num_bodies; j += HERMITE_LANES)
+		{
+			for (int lane = 0; lane < HERMITE_LANES; ++lane)
+			{
+				pair(j + lane, lane);
+			}
+		}
+
+		for (; j < num_bodies; ++j)
+		{
+			pair(j, 0);
+		}
+
+		hermite_pull pull;
+		bool any_contact{ false };
+		bool any_heat{ false };
+
+		for (int lane = 0; lane < HERMITE_LANES; ++lane)
+		{
+			pull.acc += vec3d_pd{ ax[lane], ay[lane], az[lane] };
+			pull.jerk += vec3d_pd{ jx[lane], jy[lane], jz[lane] };
+
+			any_contact |= contact[lane] != 0;
+			any_heat |= heat[lane] != 0;
+		}
+
+		if (any_contact)
+		{
+			for (j = 0; j < num_bodies; ++j)
+			{
+				const double dx{ x[j] - xi };
+				const double dy{ y[j] - yi };
+				const double dz{ z[j] - zi };
+
+				if (j != i && !(std::sqrt(dx * dx + dy * dy + dz * dz) > ri + radius[j]))
+				{
+					on_collision(i, j);
+				}
+			}
+		}
+
+		if (any_heat)
+		{
+			on_tidal_heating(i);
+		}
+
+		return pull;
+	}
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include "vec3d.h"
+#include "kahan.h"
+#include "Allocators.h"
+#include "Labels.h"
+
+namespace gravity
+{
+	// the per-body arrays, with their memory as body_memory says
+	template <typename T>
+	using body_vector = std::vector<T, body_allocator<T>>;
+
+	// the per-body arrays that the force kernels read for every pair
+	template <typename T>
+	using hot_vector = body_vector<T>;
+
+	//
+	// Index map of a stable compaction: remap[i] is where the element i goes, -1 when it's dropped. Returns the
+	// number of the elements kept
+	//
+	template <typename TFlags, typename TRemap>
+	inline size_t compaction_remap(const TFlags& to_remove, TRemap& remap)
+	{
+		remap.resize(to_remove.size());
+
+		int kept{ 0 };
+
+		for (size_t i = 0; i < to_remove.size(); ++i)
+		{
+			remap[i] = to_remove[i] ? -1 : kept++;
+		}
+
+		return static_cast<size_t>(kept);
+	}
+
+	//
+	// Single pass stable compaction of an array by the above. The elements only ever move down, so it's in place
+	//
+	template <typename TVector, typename TRemap>
+	inline void compact(TVector& v, const TRemap& remap, size_t kept)
+	{
+		for (size_t i = 0; i < remap.size(); ++i)
+		{
+			const int dst{ remap[i] };
+
+			if (dst >= 0 && static_cast<size_t>(dst) != i)
+			{
+				v[dst] = std::move(v[i]);
+			}
+		}
+
+		v.resize(kept);
+	}
+
+	//
+	// A Kahan-summed element of an acc3d_vector, referring to its value and its compensation where they are stored.
+	// Reading .value only touches the value array
+	//
+	template <typename TVec3>
+	struct acc3d_ref
+	{
+		TVec3& value;
+		TVec3& compensation;
+
+		inline operator acc3d() const noexcept
+		{
+			acc3d ret{ value };
+			ret.compensation = compensation;
+			return ret;
+		}
+
+		inline acc3d_ref& operator=(const acc3d& other) noexcept
+		{
+			value = other.value;
+			compensation = other.compensation;
+			return *this;
+		}
+
+		inline acc3d_ref& operator+=(const vec3d_pd& input) noexcept
+		{
+			acc3d sum{ *this };
+			sum += input;
+			return *this = sum;
+		}
+	};
+
+	//
+	// Array of acc3d with the values and the Kahan compensations apart, so the loops that only need the values
+	// stream half the bytes
+	//
+	struct acc3d_vector
+	{
+		body_vector<vec3d_pd> value;
+		body_vector<vec3d_pd> compensation;
+
+		inline size_t size() const noexcept
+		{
+			return value.size();
+		}
+
+		void resize(size_t n)
+		{
+			value.resize(n);
+			compensation.resize(n);
+		}
+
+		void push_back(const acc3d& a)
+		{
+			value.push_back(a.value);
+			compensation.push_back(a.compensation);
+		}
+
+		void set_zero() noexcept
+		{
+			std::fill(value.begin(), value.end(), vec3d_pd{ 0.0, 0.0, 0.0 });
+			std::fill(compensation.begin(), compensation.end(), vec3d_pd{ 0.0, 0.0, 0.0 });
+		}
+
+		inline acc3d_ref<vec3d_pd> operator[](size_t idx) noexcept
+		{
+			return { value[idx], compensation[idx] };
+		}
+
+		inline acc3d_ref<const vec3d_pd> operator[](size_t idx) const noexcept
+		{
+			return { value[idx], compensation[idx] };
+		}
+	};
+
+	//
+	// State of a single body within a single generation, as seen by the integrators.
+	// This is a temporary gathered from / scattered back into the SoA storage below
+	//
+	struct body_state
+	{
+		acc3d location{};
+		acc3d velocity{};
+		acc3d gravity_acceleration{};
+	};
+
+	//
+	// One generation of the bodies' dynamic state, kept as a structure of arrays.
+	//
+	// Force kernels only ever need the positions, so these are kept in contiguous x / y / z arrays.
+	// The Kahan compensations of the location, the velocity and the acceleration are in cold side
+	// arrays that are only touched by the integrators that sum with them
+	//
+	struct body_generation
+	{
+		hot_vector<double> x;
+		hot_vector<double> y;
+		hot_vector<double> z;
+
+		body_vector<vec3d_pd> location_compensation;
+
+		acc3d_vector velocity;
+		acc3d_vector gravity_acceleration;
+
+		inline size_t size() const noexcept
+		{
+			return x.size();
+		}
+
+		void resize(size_t n)
+		{
+			x.resize(n);
+			y.resize(n);
+			z.resize(n);
+			location_compensation.resize(n);
+			velocity.resize(n);
+			gravity_acceleration.resize(n);
+		}
+
+		void push_back(const body_state& state)
+		{
+			x.push_back(state.location.value.x());
+			y.push_back(state.location.value.y());
+			z.push_back(state.location.value.z());
+			location_compensation.push_back(state.location.compensation);
+			velocity.push_back(state.velocity);
+			gravity_acceleration.push_back(state.gravity_acceleration);
+		}
+
+		template <typename TFunc>
+		void for_each_array(TFunc&& func)
+		{
+			func(x);
+			func(y);
+			func(z);
+			func(location_compensation);
+			func(velocity.value);
+			func(velocity.compensation);
+			func(gravity_acceleration.value);
+			func(gravity_acceleration.compensation);
+		}
+
+		template <typename TRemap>
+		void compact(const TRemap& remap, size_t kept)
+		{
+			gravity::compact(x, remap, kept);
+			gravity::compact(y, remap, kept);
+			gravity::compact(z, remap, kept);
+			gravity::compact(location_compensation, remap, kept);
+			gravity::compact(velocity.value, remap, kept);
+			gravity::compact(velocity.compensation, remap, kept);
+			gravity::compact(gravity_acceleration.value, remap, kept);
+			gravity::compact(gravity_acceleration.compensation, remap, kept);
+		}
+
+		inline vec3d_pd location_value(size_t idx) const noexcept
+		{
+			return { x[idx], y[idx], z[idx] };
+		}
+
+		inline acc3d location(size_t idx) const noexcept
+		{
+			acc3d ret{ location_value(idx) };
+			ret.compensation = location_compensation[idx];
+			return ret;
+		}
+
+		inline void set_location(size_t idx, const acc3d& location) noexcept
+		{
+			x[idx] = location.value.x();
+			y[idx] = location.value.y();
+			z[idx] = location.value.z();
+			location_compensation[idx] = location.compensation;
+		}
+
+		inline body_state get_state(size_t idx) const noexcept
+		{
+			return { location(idx), velocity[idx], gravity_acceleration[idx] };
+		}
+
+		inline void set_state(size_t idx, const body_state& state) noexcept
+		{
+			set_location(idx, state.location);
+			velocity[idx] = state.velocity;
+			gravity_acceleration[idx] = state.gravity_acceleration;
+		}
+	};
+
+	//
+	// Generation-independent properties of the bodies. mass_G and radius are read by the force kernels
+	// for every pair, so these are kept hot, the rest is only touched by merges and reports
+	//
+	struct body_properties
+	{
+		hot_vector<double> mass_G;
+		hot_vector<double> radius;
+
+		std::vector<double> mass;
+		std::vector<double> temperature;
+		std::vector<uint32_t> label;		// into labels
+
+		label_table labels;
+
+		inline size_t size() const noexcept
+		{
+			return mass_G.size();
+		}
+
+		void resize(size_t n)
+		{
+			mass_G.resize(n);
+			radius.resize(n);
+			mass.resize(n);
+			temperature.resize(n);
+			label.resize(n);
+		}
+
+		template <typename TRemap>
+		void compact(const TRemap& remap, size_t kept)
+		{
+			gravity::compact(mass_G, remap, kept);
+			gravity::compact(radius, remap, kept);
+			gravity::compact(mass, remap, kept);
+			gravity::compact(temperature, remap, kept);
+			gravity::compact(label, remap, kept);
+
+			labels.compact(label);
+		}
+	};
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// Collision detection on its own, out of the force kernels: sweep and prune of the bodies along x, then a swept
+	// sphere test of the pairs whose boxes overlap.
+	//
+	// Each body is boxed over its whole straight path from the start to the end location, grown by its radius, so
+	// the bodies that pass through each other within the step are found too, not only the ones that end up
+	// overlapping. The boxes are kept in their order from the previous call and insertion sorted, as the bodies
+	// hardly change their order along x from one call to the next - so it's near O(N), plus the pairs that overlap
+	//
+	class broad_phase
+	{
+		struct extent
+		{
+			double lo;
+			double hi;
+			int i;
+		};
+
+		std::vector<extent> _extents;
+
+	public:
+		//
+		// Reports the pairs i < j whose spheres meet along their paths from x0 / y0 / z0 to x1 / y1 / z1 to
+		// on_contact(i, j), once each
+		//
+		template <typename TOnContact>
+		void find(
+			int num_bodies,
+			const double* x0,
+			const double* y0,
+			const double* z0,
+			const double* x1,
+			const double* y1,
+			const double* z1,
+			const double* radius,
+			TOnContact&& on_contact
+		)
+		{
+			if (static_cast<int>(_extents.size()) != num_bodies)
+			{
+				_extents.resize(num_bodies);
+
+				for (int i = 0; i < num_bodies; ++i)
+				{
+					_extents[i].i = i;
+				}
+			}
+
+			for (auto& e : _extents)
+			{
+				e.lo = std::min(x0[e.i], x1[e.i]) - radius[e.i];
+				e.hi = std::max(x0[e.i], x1[e.i]) + radius[e.i];
+			}
+
+			for (int k = 1; k < num_bodies; ++k)
+			{
+				const extent e{ _extents[k] };
+
+				int l = k;
+				for (; l > 0 && _extents[l - 1].lo > e.lo; --l)
+				{
+					_extents[l] = _extents[l - 1];
+				}
+
+				_extents[l] = e;
+			}
+
+			for (int k = 0; k < num_bodies; ++k)
+			{
+				const extent& a{ _extents[k] };
+
+				for (int l = k + 1; l < num_bodies && _extents[l].lo <= a.hi; ++l)
+				{
+					const int i{ std::min(a.i, _extents[l].i) };
+					const int j{ std::max(a.i, _extents[l].i) };
+
+					const double r_sum{ radius[i] + radius[j] };
+
+					if (std::max(std::min(y0[i], y1[i]) - radius[i], std::min(y0[j], y1[j]) - radius[j]) >
+						std::min(std::max(y0[i], y1[i]) + radius[i], std::max(y0[j], y1[j]) + radius[j]))
+						continue;
+
+					if (std::max(std::min(z0[i], z1[i]) - radius[i], std::min(z0[j], z1[j]) - radius[j]) >
+						std::min(std::max(z0[i], z1[i]) + radius[i], std::max(z0[j], z1[j]) + radius[j]))
+						continue;
+
+					// closest approach of the two along their straight paths
+					const double dx0{ x0[j] - x0[i] };
+					const double dy0{ y0[j] - y0[i] };
+					const double dz0{ z0[j] - z0[i] };
+
+					const double ex{ (x1[j] - x1[i]) - dx0 };
+					const double ey{ (y1[j] - y1[i]) - dy0 };
+					const double ez{ (z1[j] - z1[i]) - dz0 };
+
+					const double e2{ ex * ex + ey * ey + ez * ez };
+					const double t{ e2 > 0.0 ? std::clamp(-(dx0 * ex + dy0 * ey + dz0 * ez) / e2, 0.0, 1.0) : 0.0 };
+
+					const double dx{ dx0 + ex * t };
+					const double dy{ dy0 + ey * t };
+					const double dz{ dz0 + ez * t };
+
+					if (!(dx * dx + dy * dy + dz * dz > r_sum * r_sum))
+					{
+						on_contact(i, j);
+					}
+				}
+			}
+		}
+	};
+}
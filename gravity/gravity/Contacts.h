@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// The colliding pairs as the parallel passes find them, one buffer per worker so no contact takes a lock, and
+	// the merge groups they add up to. The groups are the connected components of the contacts (union-find), so
+	// a body that touches two others ends up in a single group with both
+	//
+	class contact_buffers
+	{
+		struct alignas(64) buffer
+		{
+			std::vector<std::pair<int, int>> pairs;
+		};
+
+		std::vector<buffer> _buffers;
+
+		std::vector<int> _parent;
+		std::vector<int> _group_of_root;
+		std::vector<std::vector<int>> _groups;
+
+		int find(int i) noexcept
+		{
+			while (_parent[i] != i)
+			{
+				_parent[i] = _parent[_parent[i]];
+				i = _parent[i];
+			}
+
+			return i;
+		}
+
+	public:
+		explicit contact_buffers(int num_workers)
+			: _buffers(std::max(1, num_workers))
+		{
+		}
+
+		//
+		// Must not be called while the workers add contacts
+		//
+		void resize(int num_workers)
+		{
+			_buffers.resize(std::max(1, num_workers));
+		}
+
+		inline void add(int worker, int i, int j)
+		{
+			_buffers[worker].pairs.push_back({ i, j });
+		}
+
+		bool empty() const noexcept
+		{
+			return std::all_of(_buffers.begin(), _buffers.end(), [](const buffer& b) { return b.pairs.empty(); });
+		}
+
+		//
+		// The merge groups of all the contacts so far, each in the ascending order of the bodies, and the buffers
+		// emptied for the next step
+		//
+		const std::vector<std::vector<int>>& gather(int num_bodies)
+		{
+			_parent.resize(num_bodies);
+			std::iota(_parent.begin(), _parent.end(), 0);
+
+			for (auto& b : _buffers)
+			{
+				for (const auto& [i, j] : b.pairs)
+				{
+					const int root_i{ find(i) };
+					const int root_j{ find(j) };
+
+					// the lower index becomes the root, so the groups come out the same whatever the order of the contacts
+					_parent[std::max(root_i, root_j)] = std::min(root_i, root_j);
+				}
+
+				b.pairs.clear();
+			}
+
+			_group_of_root.assign(num_bodies, -1);
+			_groups.clear();
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				const int root{ find(i) };
+
+				if (root == i)
+					continue;
+
+				if (_group_of_root[root] < 0)
+				{
+					_group_of_root[root] = static_cast<int>(_groups.size());
+					_groups.push_back({ root });
+				}
+
+				_groups[_group_of_root[root]].push_back(i);
+			}
+
+			return _groups;
+		}
+	};
+}
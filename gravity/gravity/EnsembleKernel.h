@@ -0,0 +1,543 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <immintrin.h>
+
+#include "vec3d.h"
+#include "kahan.h"
+#include "Integrators.h"
+#include "WorldObjects.h"
+
+namespace gravity
+{
+	//
+	// One double per ensemble member: lane k of every register belongs to the scenario k of the ensemble
+	//
+#if defined(AVX512)
+
+	static constexpr int ENSEMBLE_WIDTH{ 8 };
+
+	struct ensemble_pd
+	{
+		__m512d v{ _mm512_setzero_pd() };
+
+		ensemble_pd() = default;
+
+		ensemble_pd(const __m512d& _v)
+			: v{ _v }
+		{
+		}
+
+		explicit ensemble_pd(double d)
+			: v{ _mm512_set1_pd(d) }
+		{
+		}
+	};
+
+	inline ensemble_pd operator+(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm512_add_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator-(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm512_sub_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator*(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm512_mul_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator/(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm512_div_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd sqrt(const ensemble_pd& a) noexcept { return { _mm512_sqrt_pd(a.v) }; }
+	inline ensemble_pd max(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm512_max_pd(lhs.v, rhs.v) }; }
+
+	// lanes where a <= b / a < b, as bits
+	inline int mask_le(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LE_OQ); }
+	inline int mask_lt(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+
+	// x where a > b, zero elsewhere
+	inline ensemble_pd keep_gt(const ensemble_pd& a, const ensemble_pd& b, const ensemble_pd& x) noexcept
+	{
+		return { _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ), x.v) };
+	}
+
+#elif defined(AVX2) || defined(AVX)
+
+	static constexpr int ENSEMBLE_WIDTH{ 4 };
+
+	struct ensemble_pd
+	{
+		__m256d v{ _mm256_setzero_pd() };
+
+		ensemble_pd() = default;
+
+		ensemble_pd(const __m256d& _v)
+			: v{ _v }
+		{
+		}
+
+		explicit ensemble_pd(double d)
+			: v{ _mm256_set1_pd(d) }
+		{
+		}
+	};
+
+	inline ensemble_pd operator+(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm256_add_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator-(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm256_sub_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator*(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm256_mul_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator/(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm256_div_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd sqrt(const ensemble_pd& a) noexcept { return { _mm256_sqrt_pd(a.v) }; }
+	inline ensemble_pd max(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm256_max_pd(lhs.v, rhs.v) }; }
+
+	inline int mask_le(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)); }
+	inline int mask_lt(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+
+	inline ensemble_pd keep_gt(const ensemble_pd& a, const ensemble_pd& b, const ensemble_pd& x) noexcept
+	{
+		return { _mm256_and_pd(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ), x.v) };
+	}
+
+#else
+
+	static constexpr int ENSEMBLE_WIDTH{ 2 };
+
+	struct ensemble_pd
+	{
+		__m128d v{ _mm_setzero_pd() };
+
+		ensemble_pd() = default;
+
+		ensemble_pd(const __m128d& _v)
+			: v{ _v }
+		{
+		}
+
+		explicit ensemble_pd(double d)
+			: v{ _mm_set1_pd(d) }
+		{
+		}
+	};
+
+	inline ensemble_pd operator+(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm_add_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator-(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm_sub_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator*(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm_mul_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd operator/(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm_div_pd(lhs.v, rhs.v) }; }
+	inline ensemble_pd sqrt(const ensemble_pd& a) noexcept { return { _mm_sqrt_pd(a.v) }; }
+	inline ensemble_pd max(const ensemble_pd& lhs, const ensemble_pd& rhs) noexcept { return { _mm_max_pd(lhs.v, rhs.v) }; }
+
+	inline int mask_le(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm_movemask_pd(_mm_cmple_pd(a.v, b.v)); }
+	inline int mask_lt(const ensemble_pd& a, const ensemble_pd& b) noexcept { return _mm_movemask_pd(_mm_cmplt_pd(a.v, b.v)); }
+
+	inline ensemble_pd keep_gt(const ensemble_pd& a, const ensemble_pd& b, const ensemble_pd& x) noexcept
+	{
+		return { _mm_and_pd(_mm_cmpgt_pd(a.v, b.v), x.v) };
+	}
+
+#endif
+
+	inline double& lane(ensemble_pd& a, int k) noexcept
+	{
+		return reinterpret_cast<double*>(&a.v)[k];
+	}
+
+	inline double lane(const ensemble_pd& a, int k) noexcept
+	{
+		return reinterpret_cast<const double*>(&a.v)[k];
+	}
+
+	inline ensemble_pd operator*(const ensemble_pd& lhs, double f) noexcept { return lhs * ensemble_pd{ f }; }
+	inline ensemble_pd operator*(double f, const ensemble_pd& rhs) noexcept { return ensemble_pd{ f } * rhs; }
+	inline ensemble_pd operator-(const ensemble_pd& a) noexcept { return ensemble_pd{} - a; }
+
+	//
+	// Same body of every ensemble member, the packed counterpart of vec3d_pd
+	//
+	struct ensemble_vec3d
+	{
+		ensemble_pd x{};
+		ensemble_pd y{};
+		ensemble_pd z{};
+
+		vec3d_pd get_lane(int k) const noexcept
+		{
+			return { lane(x, k), lane(y, k), lane(z, k) };
+		}
+
+		void set_lane(int k, const vec3d_pd& vec) noexcept
+		{
+			lane(x, k) = vec.x();
+			lane(y, k) = vec.y();
+			lane(z, k) = vec.z();
+		}
+	};
+
+	inline ensemble_vec3d operator+(const ensemble_vec3d& lhs, const ensemble_vec3d& rhs) noexcept { return { lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z }; }
+	inline ensemble_vec3d operator-(const ensemble_vec3d& lhs, const ensemble_vec3d& rhs) noexcept { return { lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z }; }
+	inline ensemble_vec3d operator*(const ensemble_vec3d& lhs, const ensemble_pd& f) noexcept { return { lhs.x * f, lhs.y * f, lhs.z * f }; }
+	inline ensemble_vec3d operator*(const ensemble_vec3d& lhs, double f) noexcept { return lhs * ensemble_pd{ f }; }
+	inline ensemble_vec3d operator*(double f, const ensemble_vec3d& rhs) noexcept { return rhs * ensemble_pd{ f }; }
+	inline ensemble_vec3d operator-(const ensemble_vec3d& a) noexcept { return { -a.x, -a.y, -a.z }; }
+
+	//
+	// State of a single body across the ensemble, as seen by the integrators (see Integrators.h)
+	//
+	struct ensemble_state
+	{
+		acc<ensemble_vec3d> location{};
+		acc<ensemble_vec3d> velocity{};
+		acc<ensemble_vec3d> gravity_acceleration{};
+	};
+
+	//
+	// ENSEMBLE_WIDTH copies of the same system (same bodies, perturbed initial conditions) stepping in lock step:
+	// every instruction of the force kernel and of the integrators works on all the copies at once, so a small
+	// system keeps the whole register busy.
+	//
+	// Merging the colliding bodies would change the number of bodies of a single copy only, which can't be done
+	// in lock step. A copy that runs into a collision is marked as collided at that iteration instead (see
+	// collided_at()): the pair is left out of its sum so that the lane keeps its place in the lock step, but the copy
+	// is no longer reported. Bodies are never removed as escaped
+	//
+	template <integration_method method>
+	class ensemble_struct
+	{
+	public:
+		static constexpr int NUM_GENERATIONS{ 4 };
+		static constexpr uint64_t NOT_COLLIDED{ std::numeric_limits<uint64_t>::max() };
+
+	private:
+		std::array<std::vector<ensemble_state>, NUM_GENERATIONS> _gens;
+
+		std::vector<ensemble_pd> _mass;
+		std::vector<ensemble_pd> _mass_G;
+		std::vector<ensemble_pd> _radius;
+		std::vector<ensemble_pd> _temperature;
+		std::vector<std::string> _labels;
+
+		int _num_lanes{ 0 };
+		std::array<uint64_t, ENSEMBLE_WIDTH> _collided_at;
+
+		uint64_t _report_every_n_iterations{ 0 };
+		uint64_t _max_iterations{ 0 };
+		uint64_t _current_iteration{ 0 };
+
+		uint64_t _simulation_start_in_epoch_time_millis{ 0 };
+
+		double _time_delta{ 0.1 };
+		double _time_delta_times_1_24{ _time_delta / 24.0 };
+
+		std::array<std::string, ENSEMBLE_WIDTH> _report_files;
+		std::string _report_centre{};
+
+		bool _first_report{ true };
+
+	public:
+		ensemble_struct()
+		{
+			_collided_at.fill(NOT_COLLIDED);
+		}
+
+		//
+		// Sets the bodies of the ensemble member k. All the members must have the same bodies in the same order,
+		// the lanes above the last set one are padded with its copies, and are not reported
+		//
+		bool set_lane(int k, const std::vector<mass_body>& bodies)
+		{
+			if (k == 0)
+			{
+				for (auto& gen : _gens)
+				{
+					gen.assign(bodies.size(), {});
+				}
+
+				_mass.assign(bodies.size(), ensemble_pd{});
+				_mass_G.assign(bodies.size(), ensemble_pd{});
+				_radius.assign(bodies.size(), ensemble_pd{});
+				_temperature.assign(bodies.size(), ensemble_pd{});
+
+				_labels.clear();
+				for (const auto& body : bodies)
+				{
+					_labels.push_back(body.label);
+				}
+			}
+			else if (bodies.size() != _labels.size())
+			{
+				return false;
+			}
+
+			for (int lane_idx = k; lane_idx < ENSEMBLE_WIDTH; ++lane_idx)
+			{
+				for (size_t i = 0; i < bodies.size(); ++i)
+				{
+					const auto& body{ bodies[i] };
+
+					for (auto& gen : _gens)
+					{
+						gen[i].location.value.set_lane(lane_idx, body.location.value);
+						gen[i].location.compensation.set_lane(lane_idx, body.location.compensation);
+						gen[i].velocity.value.set_lane(lane_idx, body.velocity.value);
+						gen[i].velocity.compensation.set_lane(lane_idx, body.velocity.compensation);
+						gen[i].gravity_acceleration.value.set_lane(lane_idx, body.gravity_acceleration.value);
+					}
+
+					lane(_mass[i], lane_idx) = body.mass;
+					lane(_mass_G[i], lane_idx) = body.mass * GRAVITATIONAL_CONSTANT;
+					lane(_radius[i], lane_idx) = body.radius;
+					lane(_temperature[i], lane_idx) = body.temperature;
+				}
+			}
+
+			_num_lanes = k + 1;
+			return true;
+		}
+
+		inline int num_lanes() const noexcept
+		{
+			return _num_lanes;
+		}
+
+		inline int num_bodies() const noexcept
+		{
+			return static_cast<int>(_labels.size());
+		}
+
+		// iteration of the first collision of the ensemble member k, NOT_COLLIDED if there was none
+		inline uint64_t collided_at(int k) const noexcept
+		{
+			return _collided_at[k];
+		}
+
+		//
+		// View of a single body of the ensemble member k, in the current generation
+		//
+		mass_body get_body(int k, int idx) const
+		{
+			const auto& state{ get_generation(0)[idx] };
+
+			mass_body body{};
+
+			body.location = acc3d{ state.location.value.get_lane(k) };
+			body.location.compensation = state.location.compensation.get_lane(k);
+			body.velocity = acc3d{ state.velocity.value.get_lane(k) };
+			body.velocity.compensation = state.velocity.compensation.get_lane(k);
+			body.gravity_acceleration = acc3d{ state.gravity_acceleration.value.get_lane(k) };
+
+			body.mass = lane(_mass[idx], k);
+			body.mass_G = lane(_mass_G[idx], k);
+			body.radius = lane(_radius[idx], k);
+			body.temperature = lane(_temperature[idx], k);
+			body.label = _labels[idx];
+
+			return body;
+		}
+
+		void set_simulation_start_in_epoch_time_millis(uint64_t value)
+		{
+			_simulation_start_in_epoch_time_millis = value;
+		}
+
+		void set_time_delta(double time_delta)
+		{
+			_time_delta = time_delta;
+			_time_delta_times_1_24 = _time_delta / 24.0;
+		}
+
+		void set_output_csv(int k, std::string output_file)
+		{
+			_report_files[k] = output_file;
+		}
+
+		void set_report_centre(std::string report_centre)
+		{
+			_report_centre = report_centre;
+		}
+
+		void set_report_every(uint64_t report_every)
+		{
+			_report_every_n_iterations = report_every;
+		}
+
+		void set_max_iterations(uint64_t max_iterations)
+		{
+			_max_iterations = max_iterations;
+		}
+
+		bool iterate() noexcept
+		{
+			iterate_forces_and_moves();
+
+			_current_iteration++;
+
+			if ((_report_every_n_iterations != 0 && (_current_iteration % _report_every_n_iterations) == 0) ||
+				(_current_iteration >= _max_iterations))
+			{
+				generate_report();
+			}
+
+			return _current_iteration < _max_iterations && !all_collided();
+		}
+
+		bool all_collided() const noexcept
+		{
+			for (int k = 0; k < _num_lanes; ++k)
+			{
+				if (_collided_at[k] == NOT_COLLIDED)
+					return false;
+			}
+
+			return true;
+		}
+
+		int64_t current_iteration() const noexcept
+		{
+			return _current_iteration;
+		}
+
+		uint64_t current_time_epoch_millis() const noexcept
+		{
+			return epoch_millis_at(_current_iteration);
+		}
+
+		uint64_t epoch_millis_at(uint64_t iteration) const noexcept
+		{
+			return _simulation_start_in_epoch_time_millis + static_cast<uint64_t>(std::round(iteration * _time_delta * 1000.0));
+		}
+
+		void generate_report()
+		{
+			for (int k = 0; k < _num_lanes; ++k)
+			{
+				// the state of a collided copy is no longer the one of a valid run
+				if (_report_files[k].empty() || _collided_at[k] != NOT_COLLIDED)
+					continue;
+
+				std::ofstream ostrm(_report_files[k], std::ios::app);
+
+				if (_first_report)
+				{
+					ostrm << mass_body::get_csv_header() << "\n";
+				}
+
+				vec3d_pd loc_centre{ 0.0, 0.0, 0.0 };
+				vec3d_pd vel_centre{ 0.0, 0.0, 0.0 };
+
+				for (int idx = 0; idx < num_bodies(); ++idx)
+				{
+					if (_labels[idx] == _report_centre)
+					{
+						loc_centre = get_generation(0)[idx].location.value.get_lane(k);
+						vel_centre = get_generation(0)[idx].velocity.value.get_lane(k);
+						break;
+					}
+				}
+
+				for (int idx = 0; idx < num_bodies(); ++idx)
+				{
+					mass_body body_copy = get_body(k, idx);
+
+					body_copy.location.value -= loc_centre;
+					body_copy.velocity.value -= vel_centre;
+
+					ostrm << body_copy.to_csv_line(_current_iteration, current_time_epoch_millis(), idx) << "\n";
+				}
+			}
+
+			_first_report = false;
+		}
+
+	private:
+		std::vector<ensemble_state>& get_generation(int gen) noexcept
+		{
+			return _gens[(_current_iteration + NUM_GENERATIONS + gen) % NUM_GENERATIONS];
+		}
+
+		const std::vector<ensemble_state>& get_generation(int gen) const noexcept
+		{
+			return _gens[(_current_iteration + NUM_GENERATIONS + gen) % NUM_GENERATIONS];
+		}
+
+		void on_collisions(int lanes) noexcept
+		{
+			for (int k = 0; k < ENSEMBLE_WIDTH; ++k)
+			{
+				if ((lanes & (1 << k)) && _collided_at[k] == NOT_COLLIDED)
+				{
+					_collided_at[k] = _current_iteration;
+				}
+			}
+		}
+
+		//
+		// Same j > i symmetric pair loop as gravity_struct::iterate_gravity_forces, for all the lanes at once
+		//
+		void iterate_gravity_forces(const std::vector<ensemble_state>& current_gen, std::vector<ensemble_state>& next_gen) noexcept
+		{
+			const int num_bodies{ this->num_bodies() };
+
+			for (auto& state : next_gen)
+			{
+				state.gravity_acceleration = {};
+			}
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				const auto& loc_a{ current_gen[i].location.value };
+				const auto tidal_r_a{ _radius[i] * 10.0 };
+
+				for (int j = i + 1; j < num_bodies; ++j)
+				{
+					const auto r_ba{ current_gen[j].location.value - loc_a };
+					const auto r2{ r_ba.x * r_ba.x + r_ba.y * r_ba.y + r_ba.z * r_ba.z };
+					const auto r_modulo{ sqrt(r2) };
+					const auto r_sum{ _radius[i] + _radius[j] };
+
+					const int collided{ mask_le(r_modulo, r_sum) };
+					if (collided != 0)
+					{
+						on_collisions(collided);
+					}
+
+					// colliding lanes are zeroed out of the pair
+					const auto inv_r3{ keep_gt(r_modulo, r_sum, ensemble_pd{ 1.0 } / (r2 * r_modulo)) };
+
+					next_gen[i].gravity_acceleration += r_ba * (_mass_G[j] * inv_r3);
+					next_gen[j].gravity_acceleration += -r_ba * (_mass_G[i] * inv_r3);
+
+					const int heated_a{ mask_lt(r_modulo, tidal_r_a) & ~collided };
+					const int heated_b{ mask_lt(r_modulo, _radius[j] * 10.0) & ~collided };
+
+					if ((heated_a | heated_b) != 0)
+					{
+						for (int k = 0; k < ENSEMBLE_WIDTH; ++k)
+						{
+							if (heated_a & (1 << k))
+								lane(_temperature[i], k) = std::max(lane(_temperature[i], k), 1000.0); // tidal forces stirr the mantel
+							if (heated_b & (1 << k))
+								lane(_temperature[j], k) = std::max(lane(_temperature[j], k), 1000.0);
+						}
+					}
+				}
+			}
+		}
+
+		void iterate_forces_and_moves() noexcept
+		{
+			auto& prev1_gen = get_generation(-2);
+			auto& prev0_gen = get_generation(-1);
+			auto& curr_gen = get_generation(0);
+			auto& next_gen = get_generation(1);
+
+			iterate_gravity_forces(curr_gen, next_gen);
+
+			if (_current_iteration == 0)
+			{
+				prev1_gen = next_gen;
+				prev0_gen = next_gen;
+				curr_gen = next_gen;
+			}
+
+			for (int i = 0; i < num_bodies(); ++i)
+			{
+				integrate<method>(prev1_gen[i], prev0_gen[i], curr_gen[i], next_gen[i], _time_delta, _time_delta_times_1_24);
+			}
+		}
+	};
+}
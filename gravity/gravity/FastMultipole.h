@@ -0,0 +1,511 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+#include "Octree.h"
+#include "WorkStealingPool.h"
+
+namespace gravity
+{
+	//
+	// Fast multipole method over the shared octree, using cartesian Taylor expansions of 1/r up to order p.
+	//
+	// Notation: for a multi-index n = (nx, ny, nz), d^n = dx^nx * dy^ny * dz^nz, and b_n(R) = D_n(1/|R|) / n! are the
+	// scaled cartesian derivatives of 1/r, computed with the recurrence
+	//   b_n = -((2|n| - 1) * sum_i R_i b_{n - e_i} + (|n| - 1) * sum_i b_{n - 2e_i}) / (|n| R^2)
+	//
+	// Multipoles of a cell (around its com): M_n = sum_j m_j (y_j - com)^n
+	// Locals of a cell (around its com), so that psi(x) = sum_j m_j / |x - y_j| = sum_k C_k (x - com)^k:
+	//   M2L: C_k += sum_n (-1)^|n| binom(n + k, n) M_n b_{n + k}(com_target - com_source)
+	//   M2M: M_n += sum_{k <= n} binom(n, k) M_k d^(n - k),	d = com_child - com_parent
+	//   L2L: C_k += sum_{n >= k} binom(n, k) C_n d^(n - k),	d = com_child - com_parent
+	// Acceleration is the gradient of psi (L2P).
+	//
+	// Interactions are found by a dual tree traversal: a pair of cells interacts via M2L when
+	// (b_max_source + b_max_target) < theta * distance, leaves that are too close are summed directly.
+	// The traversal records interaction lists per target cell, so M2L and the final per-body pass run in parallel
+	// without any write conflicts.
+	//
+	class fmm_solver
+	{
+	public:
+		static constexpr int LEAF_SIZE{ 64 };
+		static constexpr int MIN_ORDER{ 1 };
+		static constexpr int MAX_ORDER{ 10 };
+		static constexpr int MAX_COEFS{ (MAX_ORDER + 1) * (MAX_ORDER + 2) * (MAX_ORDER + 3) / 6 };
+
+	private:
+		struct shift_term
+		{
+			int big;
+			int small;
+			int diff;
+			double binom;
+		};
+
+		struct m2l_term
+		{
+			int k;
+			int n;
+			int n_k;
+			double coef;	// (-1)^|n| binom(n + k, n)
+		};
+
+		struct grad_term
+		{
+			int k;
+			int axis;
+			int k_minus;	// k - e_axis
+			double k_axis;
+		};
+
+		using coefs = std::array<double, MAX_COEFS>;
+
+		work_stealing_pool& _pool;
+
+		octree _tree;
+
+		int _order{ 0 };
+		int _num_coefs{ 0 };
+		double _theta{ 0.5 };
+
+		std::vector<std::array<int, 3>> _powers;		// coefficient -> multi-index, sorted by the total degree
+		std::vector<int> _pow_parent;					// d^n = d^(n - e_axis) * d[axis]
+		std::vector<int> _pow_axis;
+		std::array<std::vector<int>, 3> _minus_1;		// index of n - e_i, -1 if none
+		std::array<std::vector<int>, 3> _minus_2;		// index of n - 2e_i, -1 if none
+
+		std::vector<shift_term> _shift_terms;
+		std::vector<m2l_term> _m2l_terms;
+		std::vector<grad_term> _grad_terms;
+
+		std::vector<double> _multipoles;				// num_nodes * _num_coefs
+		std::vector<double> _locals;
+
+		std::vector<int> _parent;
+		std::vector<int> _leaf_of;						// tree order -> leaf node
+
+		std::vector<std::vector<int>> _m2l_lists;		// target node -> source nodes
+		std::vector<std::vector<int>> _p2p_lists;		// target leaf -> source leaves
+
+	public:
+		explicit fmm_solver(work_stealing_pool& pool)
+			: _pool{ pool }
+		{
+			_tree.set_leaf_size(LEAF_SIZE);
+			set_order(4);
+		}
+
+		void set_opening_angle(double theta) noexcept
+		{
+			_theta = theta;
+		}
+
+		void set_order(int order)
+		{
+			if (order == _order)
+				return;
+
+			_order = std::max(MIN_ORDER, std::min(MAX_ORDER, order));
+			build_tables();
+		}
+
+		inline int size() const noexcept
+		{
+			return _tree.size();
+		}
+
+		// body index of the k-th body in the tree order
+		inline int body_at(int k) const noexcept
+		{
+			return _tree.body_at(k);
+		}
+
+		//
+		// Builds the tree and runs everything up to the local expansions of the leaves: upward pass,
+		// dual tree traversal, M2L and the downward pass
+		//
+		void build(const body_generation& generation, const body_properties& props)
+		{
+			_tree.build(generation, props);
+
+			const auto& nodes{ _tree.nodes() };
+			const int num_nodes{ static_cast<int>(nodes.size()) };
+
+			_multipoles.assign(static_cast<size_t>(num_nodes) * _num_coefs, 0.0);
+			_locals.assign(static_cast<size_t>(num_nodes) * _num_coefs, 0.0);
+
+			_parent.assign(num_nodes, -1);
+			_leaf_of.resize(_tree.size());
+
+			_m2l_lists.resize(num_nodes);
+			_p2p_lists.resize(num_nodes);
+
+			for (int n = 0; n < num_nodes; ++n)
+			{
+				_m2l_lists[n].clear();
+				_p2p_lists[n].clear();
+
+				for (int child = n + 1; child < nodes[n].next; child = nodes[child].next)
+				{
+					_parent[child] = n;
+				}
+
+				if (nodes[n].leaf)
+				{
+					for (int k = nodes[n].begin; k < nodes[n].end; ++k)
+					{
+						_leaf_of[k] = n;
+					}
+				}
+			}
+
+			if (num_nodes == 0)
+				return;
+
+			upward_pass();
+
+			interact(0, 0);
+
+			_pool.parallel_for(0, num_nodes,
+				[&](int target)
+				{
+					for (auto source : _m2l_lists[target])
+					{
+						m2l(source, target);
+					}
+				});
+
+			downward_pass();
+		}
+
+		//
+		// Acceleration of the k-th body (in the tree order): the local expansion of its leaf plus the direct pull
+		// of the nearby leaves
+		//
+		template <typename TOnCollision, typename TOnTidalHeating>
+		vec3d_pd acceleration(int k, TOnCollision&& on_collision, TOnTidalHeating&& on_tidal_heating) const noexcept
+		{
+			const auto& nodes{ _tree.nodes() };
+			const int leaf{ _leaf_of[k] };
+
+			coefs d_pow;
+			powers(_tree.location(k) - nodes[leaf].com, d_pow);
+
+			const double* local{ &_locals[static_cast<size_t>(leaf) * _num_coefs] };
+
+			std::array<double, 3> grad{ 0.0, 0.0, 0.0 };
+
+			for (const auto& t : _grad_terms)
+			{
+				grad[t.axis] += local[t.k] * t.k_axis * d_pow[t.k_minus];
+			}
+
+			vec3d_pd acc{ grad[0], grad[1], grad[2] };
+
+			for (auto source : _p2p_lists[leaf])
+			{
+				acc += _tree.leaf_pull(k, nodes[source], on_collision, on_tidal_heating);
+			}
+
+			return acc;
+		}
+
+	private:
+		inline int coef_index(int nx, int ny, int nz) const noexcept
+		{
+			// degree-sorted position of the multi-index, see build_tables()
+			const int deg{ nx + ny + nz };
+			const int before{ deg * (deg + 1) * (deg + 2) / 6 };
+			const int rest{ deg - nx };
+			return before + rest * (rest + 1) / 2 + (rest - ny);
+		}
+
+		void build_tables()
+		{
+			static constexpr auto binomial = [](int n, int k) noexcept
+			{
+				double r{ 1.0 };
+				for (int i = 1; i <= k; ++i)
+					r = r * (n - k + i) / i;
+				return r;
+			};
+
+			_powers.clear();
+
+			for (int deg = 0; deg <= _order; ++deg)
+			{
+				for (int nx = deg; nx >= 0; --nx)
+				{
+					for (int ny = deg - nx; ny >= 0; --ny)
+					{
+						_powers.push_back({ nx, ny, deg - nx - ny });
+					}
+				}
+			}
+
+			_num_coefs = static_cast<int>(_powers.size());
+
+			_pow_parent.assign(_num_coefs, -1);
+			_pow_axis.assign(_num_coefs, 0);
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				_minus_1[axis].assign(_num_coefs, -1);
+				_minus_2[axis].assign(_num_coefs, -1);
+			}
+
+			for (int c = 0; c < _num_coefs; ++c)
+			{
+				const auto& n{ _powers[c] };
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					auto m{ n };
+					if (m[axis] >= 1)
+					{
+						m[axis] -= 1;
+						_minus_1[axis][c] = coef_index(m[0], m[1], m[2]);
+
+						if (_pow_parent[c] == -1)
+						{
+							_pow_parent[c] = _minus_1[axis][c];
+							_pow_axis[c] = axis;
+						}
+					}
+					if (m[axis] >= 1)
+					{
+						m[axis] -= 1;
+						_minus_2[axis][c] = coef_index(m[0], m[1], m[2]);
+					}
+				}
+			}
+
+			_shift_terms.clear();
+			_m2l_terms.clear();
+			_grad_terms.clear();
+
+			for (int big = 0; big < _num_coefs; ++big)
+			{
+				const auto& n{ _powers[big] };
+
+				for (int small = 0; small < _num_coefs; ++small)
+				{
+					const auto& k{ _powers[small] };
+
+					if (k[0] <= n[0] && k[1] <= n[1] && k[2] <= n[2])
+					{
+						_shift_terms.push_back({
+							big,
+							small,
+							coef_index(n[0] - k[0], n[1] - k[1], n[2] - k[2]),
+							binomial(n[0], k[0]) * binomial(n[1], k[1]) * binomial(n[2], k[2])
+							});
+					}
+				}
+			}
+
+			for (int kc = 0; kc < _num_coefs; ++kc)
+			{
+				const auto& k{ _powers[kc] };
+				const int k_deg{ k[0] + k[1] + k[2] };
+
+				for (int nc = 0; nc < _num_coefs; ++nc)
+				{
+					const auto& n{ _powers[nc] };
+					const int n_deg{ n[0] + n[1] + n[2] };
+
+					if (n_deg + k_deg > _order)
+						continue;
+
+					const double sign{ (n_deg % 2) == 0 ? 1.0 : -1.0 };
+
+					_m2l_terms.push_back({
+						kc,
+						nc,
+						coef_index(n[0] + k[0], n[1] + k[1], n[2] + k[2]),
+						sign * binomial(n[0] + k[0], n[0]) * binomial(n[1] + k[1], n[1]) * binomial(n[2] + k[2], n[2])
+						});
+				}
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (k[axis] > 0)
+					{
+						_grad_terms.push_back({ kc, axis, _minus_1[axis][kc], static_cast<double>(k[axis]) });
+					}
+				}
+			}
+		}
+
+		inline void powers(const vec3d_pd& d, coefs& out) const noexcept
+		{
+			const std::array<double, 3> dd{ d.x(), d.y(), d.z() };
+
+			out[0] = 1.0;
+			for (int c = 1; c < _num_coefs; ++c)
+			{
+				out[c] = out[_pow_parent[c]] * dd[_pow_axis[c]];
+			}
+		}
+
+		inline void derivatives(const vec3d_pd& r, coefs& out) const noexcept
+		{
+			const std::array<double, 3> rr{ r.x(), r.y(), r.z() };
+			const double r2{ vec3d_pd::dot(r, r) };
+
+			out[0] = 1.0 / std::sqrt(r2);
+
+			for (int c = 1; c < _num_coefs; ++c)
+			{
+				const auto& n{ _powers[c] };
+				const int deg{ n[0] + n[1] + n[2] };
+
+				double sum_1{ 0.0 };
+				double sum_2{ 0.0 };
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (_minus_1[axis][c] >= 0)
+						sum_1 += rr[axis] * out[_minus_1[axis][c]];
+					if (_minus_2[axis][c] >= 0)
+						sum_2 += out[_minus_2[axis][c]];
+				}
+
+				out[c] = -((2 * deg - 1) * sum_1 + (deg - 1) * sum_2) / (deg * r2);
+			}
+		}
+
+		void upward_pass()
+		{
+			const auto& nodes{ _tree.nodes() };
+			const int num_nodes{ static_cast<int>(nodes.size()) };
+
+			// P2M
+			_pool.parallel_for(0, num_nodes,
+				[&](int n)
+				{
+					const auto& nd{ nodes[n] };
+					if (!nd.leaf)
+						return;
+
+					double* multipole{ &_multipoles[static_cast<size_t>(n) * _num_coefs] };
+					coefs d_pow;
+
+					for (int k = nd.begin; k < nd.end; ++k)
+					{
+						powers(_tree.location(k) - nd.com, d_pow);
+
+						const double m{ _tree.mass_G(k) };
+						for (int c = 0; c < _num_coefs; ++c)
+						{
+							multipole[c] += m * d_pow[c];
+						}
+					}
+				});
+
+			// M2M, children first
+			coefs d_pow;
+
+			for (int n = num_nodes - 1; n >= 0; --n)
+			{
+				const auto& nd{ nodes[n] };
+				if (nd.leaf)
+					continue;
+
+				double* multipole{ &_multipoles[static_cast<size_t>(n) * _num_coefs] };
+
+				for (int child = n + 1; child < nd.next; child = nodes[child].next)
+				{
+					const double* child_multipole{ &_multipoles[static_cast<size_t>(child) * _num_coefs] };
+
+					powers(nodes[child].com - nd.com, d_pow);
+
+					for (const auto& t : _shift_terms)
+					{
+						multipole[t.big] += t.binom * child_multipole[t.small] * d_pow[t.diff];
+					}
+				}
+			}
+		}
+
+		void interact(int source, int target)
+		{
+			const auto& nodes{ _tree.nodes() };
+			const auto& src{ nodes[source] };
+			const auto& tgt{ nodes[target] };
+
+			const auto r{ tgt.com - src.com };
+			const double dist2{ vec3d_pd::dot(r, r) };
+			const double b{ src.b_max + tgt.b_max };
+
+			if (source != target && b * b < _theta * _theta * dist2)
+			{
+				_m2l_lists[target].push_back(source);
+			}
+			else if (src.leaf && tgt.leaf)
+			{
+				_p2p_lists[target].push_back(source);
+			}
+			else if (tgt.leaf || (!src.leaf && src.b_max > tgt.b_max))
+			{
+				for (int child = source + 1; child < src.next; child = nodes[child].next)
+				{
+					interact(child, target);
+				}
+			}
+			else
+			{
+				for (int child = target + 1; child < tgt.next; child = nodes[child].next)
+				{
+					interact(source, child);
+				}
+			}
+		}
+
+		void m2l(int source, int target) noexcept
+		{
+			const auto& nodes{ _tree.nodes() };
+
+			coefs b;
+			derivatives(nodes[target].com - nodes[source].com, b);
+
+			const double* multipole{ &_multipoles[static_cast<size_t>(source) * _num_coefs] };
+			double* local{ &_locals[static_cast<size_t>(target) * _num_coefs] };
+
+			for (const auto& t : _m2l_terms)
+			{
+				local[t.k] += t.coef * multipole[t.n] * b[t.n_k];
+			}
+		}
+
+		void downward_pass() noexcept
+		{
+			const auto& nodes{ _tree.nodes() };
+			const int num_nodes{ static_cast<int>(nodes.size()) };
+
+			coefs d_pow;
+
+			// L2L, parents first
+			for (int n = 1; n < num_nodes; ++n)
+			{
+				const int parent{ _parent[n] };
+
+				const double* parent_local{ &_locals[static_cast<size_t>(parent) * _num_coefs] };
+				double* local{ &_locals[static_cast<size_t>(n) * _num_coefs] };
+
+				powers(nodes[n].com - nodes[parent].com, d_pow);
+
+				for (const auto& t : _shift_terms)
+				{
+					local[t.small] += t.binom * parent_local[t.big] * d_pow[t.diff];
+				}
+			}
+		}
+	};
+}
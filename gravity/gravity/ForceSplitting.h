@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "vec3d.h"
+#include "Subsystems.h"
+
+namespace gravity
+{
+	//
+	// Near / far split of the pair forces for the multiple time stepping (RESPA, Tuckerman et al. 1992): the near
+	// pairs are stepped at the substep, the far ones only pull once per time_delta, as an impulse.
+	//
+	// By hierarchy (cutoff 0) a pair is near when it's within the same subsystem (a planet and the moons in its Hill
+	// sphere, see subsystems), or when one of the two is the central body. It's checked every step, as the bodies
+	// may move between the subsystems.
+	//
+	// By distance the pairs are split smoothly between SWITCH_INNER * cutoff and the cutoff, so the force on a pair
+	// moving across doesn't jump. The near pairs are listed with a skin, whatever enters the cutoff from beyond
+	// SKIN * cutoff within a single time_delta is missed until the next one
+	//
+	class force_split
+	{
+		static constexpr double SWITCH_INNER{ 0.8 };
+		static constexpr double SKIN{ 1.5 };
+
+		int _substeps{ 8 };
+		double _cutoff{ 0.0 };
+
+		subsystems _hierarchy;
+
+		std::vector<std::vector<int>> _near;
+
+	public:
+		void configure(int substeps, double cutoff) noexcept
+		{
+			_substeps = substeps;
+			_cutoff = cutoff;
+		}
+
+		inline int substeps() const noexcept
+		{
+			return _substeps;
+		}
+
+		inline bool by_distance() const noexcept
+		{
+			return _cutoff > 0.0;
+		}
+
+		inline const std::vector<int>& near(int i) const noexcept
+		{
+			return _near[i];
+		}
+
+		inline std::vector<int>& near(int i) noexcept
+		{
+			return _near[i];
+		}
+
+		//
+		// Subsystems of the bodies, by hierarchy only. O(N^2) with no allocations while the hierarchy stays, returns
+		// whether the split has changed
+		//
+		bool assign_subsystems(int num_bodies, const double* x, const double* y, const double* z, const double* mass_G)
+		{
+			_near.resize(num_bodies);
+
+			return !by_distance() && _hierarchy.assign(num_bodies, x, y, z, mass_G);
+		}
+
+		//
+		// Share of the pair force that goes with the near pairs
+		//
+		inline double near_weight(int i, int j, double r) const noexcept
+		{
+			if (!by_distance())
+			{
+				const int central{ _hierarchy.central() };
+
+				return (_hierarchy.subsystem(i) == _hierarchy.subsystem(j) || i == central || j == central) ? 1.0 : 0.0;
+			}
+
+			const double inner{ SWITCH_INNER * _cutoff };
+
+			if (r <= inner)
+				return 1.0;
+
+			if (r >= _cutoff)
+				return 0.0;
+
+			const double t{ (r - inner) / (_cutoff - inner) };
+			return 1.0 - t * t * (3.0 - 2.0 * t);
+		}
+
+		//
+		// Whether the pair goes on the near list of i
+		//
+		inline bool is_near(int i, int j, double r) const noexcept
+		{
+			return by_distance() ? r < SKIN * _cutoff : near_weight(i, j, r) > 0.0;
+		}
+	};
+}
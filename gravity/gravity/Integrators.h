@@ -0,0 +1,299 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+#include "vec3d.h"
+#include "kahan.h"
+
+namespace gravity
+{
+	enum class integration_method
+	{
+		linear,
+		linear_kahan,
+		quadratic,
+		quadratic_kahan,
+		cubic,
+		cubic_kahan,
+		leapfrog,
+		yoshida4,
+		yoshida6,
+		wisdom_holman,
+		bulirsch_stoer,
+		block_steps,
+		hermite4,
+		respa,
+		hierarchical,
+		ks_regularized,
+	};
+
+	//
+	// The symplectic methods don't use the history, they step through kick_drift stages instead (see
+	// gravity_struct::iterate_composition and gravity_struct::iterate_wisdom_holman)
+	//
+	constexpr bool is_symplectic(integration_method method) noexcept
+	{
+		return method == integration_method::leapfrog ||
+			method == integration_method::yoshida4 ||
+			method == integration_method::yoshida6 ||
+			method == integration_method::wisdom_holman;
+	}
+
+	//
+	// The adaptive methods pick their own steps to meet a tolerance, see gravity_struct::iterate_bulirsch_stoer
+	//
+	constexpr bool is_adaptive(integration_method method) noexcept
+	{
+		return method == integration_method::bulirsch_stoer;
+	}
+
+	//
+	// The methods with individual power of two steps per body, see gravity_struct::iterate_block_steps
+	//
+	constexpr bool has_block_steps(integration_method method) noexcept
+	{
+		return method == integration_method::block_steps ||
+			method == integration_method::hermite4;
+	}
+
+	//
+	// The methods that split the forces into the fast and the slow ones, see gravity_struct::iterate_respa,
+	// gravity_struct::iterate_hierarchical and gravity_struct::iterate_ks_regularized
+	//
+	constexpr bool has_force_split(integration_method method) noexcept
+	{
+		return method == integration_method::respa ||
+			method == integration_method::hierarchical ||
+			method == integration_method::ks_regularized;
+	}
+
+	//
+	// Methods that drive the force passes themselves (through kick_drift stages, per block, or per force split),
+	// rather than integrate()
+	//
+	constexpr bool uses_kick_drift(integration_method method) noexcept
+	{
+		return is_symplectic(method) || is_adaptive(method) || has_block_steps(method) || has_force_split(method);
+	}
+
+	//
+	// Number of the past generations (before the current one) that the method needs
+	//
+	constexpr int history_depth(integration_method method) noexcept
+	{
+		switch (method)
+		{
+		case integration_method::quadratic:
+		case integration_method::quadratic_kahan:
+			return 1;
+		case integration_method::cubic:
+		case integration_method::cubic_kahan:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+
+	//
+	// Size of the ring of generations: the current and the next one plus the history of the multistep methods.
+	// The kick-drift methods keep the two past slots as the scratch generations of their stages
+	//
+	constexpr int generations_count(integration_method method) noexcept
+	{
+		return uses_kick_drift(method) ? 4 : history_depth(method) + 2;
+	}
+
+	//
+	// The integrators are templates over the state of a body, which only needs location / velocity /
+	// gravity_acceleration accumulators - so the same formulas serve the scalar bodies (body_state) as well as the
+	// SIMD packed ensembles (see EnsembleKernel.h)
+	//
+
+	template <typename TState>
+	inline void iterate_linear(const TState& current, TState& next, double time_delta) noexcept
+	{
+		next.velocity.value = current.velocity.value + next.gravity_acceleration.value * time_delta;
+		next.location.value = current.location.value + next.velocity.value * time_delta;
+	}
+
+	template <typename TState>
+	inline void iterate_linear_kahan(const TState& current, TState& next, double time_delta) noexcept
+	{
+		next.velocity = current.velocity + next.gravity_acceleration.value * time_delta;
+		next.location = current.location + next.velocity.value * time_delta;
+	}
+
+	//
+	// This method uses the current value - v_0, previous v_1 and the one before v_2 to 
+	// interpolate the curve into quadratic equation, then using exact integration on the range from (t-time_delta/2, t+time_delta/2) we
+	// find the value of velocity / location change based on a quadratic approximation to the actual function
+	// 
+	template <typename TState>
+	inline void iterate_quadratic(const TState& prev0, const TState& current, TState& next, double time_delta_times_1_24) noexcept
+	{
+		next.velocity.value = current.velocity.value
+			+ (
+				25 * next.gravity_acceleration.value
+				- 2 * current.gravity_acceleration.value
+				+ prev0.gravity_acceleration.value
+			) * time_delta_times_1_24;
+		next.location.value = current.location.value + 
+			(
+				25 * next.velocity.value + 
+				- 2 * current.velocity.value 
+				+ prev0.velocity.value
+			) * time_delta_times_1_24;
+	}
+
+	//
+	// Same as above, but using Kahan accumulators for velocity / location 
+	//
+	template <typename TState>
+	inline void iterate_quadratic_kahan(const TState& prev0, const TState& current, TState& next, double time_delta_times_1_24) noexcept
+	{
+		next.velocity = current.velocity
+			+ (
+				25 * next.gravity_acceleration.value 
+				- 2 * current.gravity_acceleration.value 
+				+ prev0.gravity_acceleration.value
+			) * time_delta_times_1_24;
+		next.location = current.location +
+			(
+				25 * next.velocity.value +
+				-2 * current.velocity.value
+				+ prev0.velocity.value
+			) * time_delta_times_1_24;
+	}
+
+	//
+	// This method is similar to quadratic, but using more history points and interpolates into cubic function 
+	// 
+	template <typename TState>
+	inline void iterate_cubic(const TState& prev1, const TState& prev0, const TState& current, TState& next, double time_delta_times_1_24) noexcept
+	{
+		next.velocity.value = current.velocity.value +
+			(
+				26 * next.gravity_acceleration.value
+				+ (-5) * current.gravity_acceleration.value
+				+ 4 * prev0.gravity_acceleration.value
+				+ (-1)* prev1.gravity_acceleration.value
+			) * time_delta_times_1_24;
+
+		next.location.value = current.location.value +
+			(
+				26 * next.velocity.value 
+				+ (-5) * current.velocity.value 
+				+ 4 * prev0.velocity.value
+				+ (-1) * prev1.velocity.value
+			) * time_delta_times_1_24;
+	}
+
+	//
+	// This method is similar to quadratic, but using more history points and interpolates into cubic function 
+	// 
+	template <typename TState>
+	inline void iterate_cubic_kahan(const TState& prev1, const TState& prev0, const TState& current, TState& next, double time_delta_times_1_24) noexcept
+	{
+		next.velocity = current.velocity +
+			(
+				26 * next.gravity_acceleration.value
+				+ (-5) * current.gravity_acceleration.value
+				+ 4 * prev0.gravity_acceleration.value
+				+ (-1) * prev1.gravity_acceleration.value
+			) * time_delta_times_1_24;
+
+		next.location = current.location +
+			(
+				26 * next.velocity.value
+				+ (-5) * current.velocity.value
+				+ 4 * prev0.velocity.value
+				+ (-1) * prev1.velocity.value
+			) * time_delta_times_1_24;
+	}
+
+	//
+	// Lengths of the kick-drift-kick leapfrog steps a symplectic step is composed of, in units of time_delta.
+	// Yoshida (1990), the 6th order one is his solution A
+	//
+	template <integration_method method>
+	constexpr auto composition_weights() noexcept
+	{
+		if constexpr (method == integration_method::leapfrog)
+		{
+			return std::array<double, 1>{ 1.0 };
+		}
+		else if constexpr (method == integration_method::yoshida4)
+		{
+			constexpr double w1{ 1.3512071919596578 };	// 1 / (2 - 2^(1/3))
+			constexpr double w0{ 1.0 - 2.0 * w1 };
+
+			return std::array<double, 3>{ w1, w0, w1 };
+		}
+		else if constexpr (method == integration_method::yoshida6)
+		{
+			constexpr double w1{ -1.17767998417887 };
+			constexpr double w2{ 0.235573213359357 };
+			constexpr double w3{ 0.784513610477560 };
+			constexpr double w0{ 1.0 - 2.0 * (w1 + w2 + w3) };
+
+			return std::array<double, 7>{ w3, w2, w1, w0, w1, w2, w3 };
+		}
+		else
+		{
+			static_assert(method != method, "Not a composition method");
+		}
+	}
+
+	//
+	// One stage of the symplectic methods: kick the velocity by the acceleration at the current location, then
+	// drift the location with the new velocity
+	//
+	template <typename TState>
+	inline void kick_drift(const TState& current, TState& next, double kick, double drift) noexcept
+	{
+		next.velocity = current.velocity + next.gravity_acceleration.value * kick;
+		next.location = current.location + next.velocity.value * drift;
+	}
+
+	template <integration_method method, typename TState>
+	inline void integrate(
+		const TState& prev1,
+		const TState& prev0,
+		const TState& current,
+		TState& next,
+		double time_delta,
+		double time_delta_times_1_24
+	) noexcept
+	{
+		if constexpr (method == integration_method::linear)
+		{
+			iterate_linear(current, next, time_delta);
+		}
+		else if constexpr (method == integration_method::linear_kahan)
+		{
+			iterate_linear_kahan(current, next, time_delta);
+		}
+		else if constexpr (method == integration_method::quadratic)
+		{
+			iterate_quadratic(prev0, current, next, time_delta_times_1_24);
+		}
+		else if constexpr (method == integration_method::quadratic_kahan)
+		{
+			iterate_quadratic_kahan(prev0, current, next, time_delta_times_1_24);
+		}
+		else if constexpr (method == integration_method::cubic)
+		{
+			iterate_cubic(prev1, prev0, current, next, time_delta_times_1_24);
+		}
+		else if constexpr (method == integration_method::cubic_kahan)
+		{
+			iterate_cubic_kahan(prev1, prev0, current, next, time_delta_times_1_24);
+		}
+		else
+		{
+			// see uses_kick_drift
+			static_assert(method != method, "Invalid integration method");
+		}
+	}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cmath>
+
+#include "vec3d.h"
+
+namespace gravity
+{
+	//
+	// Stumpff functions c0..c3 of x, c_k(x) = sum_n (-x)^n / (2n + k)!
+	//
+	inline void stumpff_functions(double x, double& c0, double& c1, double& c2, double& c3) noexcept
+	{
+		if (std::abs(x) < 1.0)
+		{
+			// the closed forms below cancel catastrophically around 0
+			double term2{ 1.0 / 2.0 };
+			double term3{ 1.0 / 6.0 };
+
+			c2 = 0.0;
+			c3 = 0.0;
+
+			for (int n = 0; n < 12; ++n)
+			{
+				c2 += term2;
+				c3 += term3;
+
+				term2 *= -x / ((2 * n + 3) * (2 * n + 4));
+				term3 *= -x / ((2 * n + 4) * (2 * n + 5));
+			}
+
+			c1 = 1.0 - x * c3;
+			c0 = 1.0 - x * c2;
+		}
+		else if (x > 0.0)
+		{
+			const double sx{ std::sqrt(x) };
+
+			c0 = std::cos(sx);
+			c1 = std::sin(sx) / sx;
+			c2 = (1.0 - c0) / x;
+			c3 = (1.0 - c1) / x;
+		}
+		else
+		{
+			const double sx{ std::sqrt(-x) };
+
+			c0 = std::cosh(sx);
+			c1 = std::sinh(sx) / sx;
+			c2 = (1.0 - c0) / x;
+			c3 = (1.0 - c1) / x;
+		}
+	}
+
+	//
+	// Advances (r, v) along the two body orbit around a fixed centre of gravitational parameter mu by dt.
+	//
+	// Universal variables (Danby, Fundamentals of Celestial Mechanics, ch. 6.9), so elliptic, parabolic and hyperbolic
+	// orbits all go through the same path. Kepler's equation is solved for the universal anomaly s with Newton's
+	// method, and when that fails to converge (dt is a good part of a very eccentric orbit) the drift is split in halves
+	//
+	class kepler_drift
+	{
+		static constexpr int MAX_NEWTON_ITERATIONS{ 32 };
+		static constexpr int MAX_SPLIT_DEPTH{ 16 };
+
+	public:
+		static void apply(vec3d_pd& r, vec3d_pd& v, double mu, double dt) noexcept
+		{
+			apply(r, v, mu, dt, 0);
+		}
+
+	private:
+		static void apply(vec3d_pd& r, vec3d_pd& v, double mu, double dt, int depth) noexcept
+		{
+			if (solve(r, v, mu, dt) || depth >= MAX_SPLIT_DEPTH)
+				return;
+
+			apply(r, v, mu, dt * 0.5, depth + 1);
+			apply(r, v, mu, dt * 0.5, depth + 1);
+		}
+
+		static bool solve(vec3d_pd& r, vec3d_pd& v, double mu, double dt) noexcept
+		{
+			const double r0{ r.modulo() };
+			const double eta0{ vec3d_pd::dot(r, v) };
+			const double beta{ 2.0 * mu / r0 - vec3d_pd::dot(v, v) };
+
+			double s{ dt / r0 };
+
+			double c0, c1, c2, c3;
+			bool converged{ false };
+
+			for (int iteration = 0; iteration < MAX_NEWTON_ITERATIONS; ++iteration)
+			{
+				stumpff_functions(beta * s * s, c0, c1, c2, c3);
+
+				const double g1{ s * c1 };
+				const double g2{ s * s * c2 };
+				const double g3{ s * s * s * c3 };
+
+				const double kepler{ r0 * g1 + eta0 * g2 + mu * g3 - dt };
+				const double radius{ r0 * c0 + eta0 * g1 + mu * g2 };
+
+				const double ds{ kepler / radius };
+				s -= ds;
+
+				if (std::abs(ds) <= 1e-15 * std::abs(s) || ds == 0.0)
+				{
+					converged = true;
+					break;
+				}
+			}
+
+			if (!converged || !std::isfinite(s))
+				return false;
+
+			stumpff_functions(beta * s * s, c0, c1, c2, c3);
+
+			const double g1{ s * c1 };
+			const double g2{ s * s * c2 };
+			const double g3{ s * s * s * c3 };
+
+			const double radius{ r0 * c0 + eta0 * g1 + mu * g2 };
+
+			const double f{ 1.0 - mu * g2 / r0 };
+			const double g{ dt - mu * g3 };
+			const double f_dot{ -mu * g1 / (radius * r0) };
+			const double g_dot{ 1.0 - mu * g2 / radius };
+
+			const vec3d_pd r_new{ r * f + v * g };
+			const vec3d_pd v_new{ r * f_dot + v * g_dot };
+
+			r = r_new;
+			v = v_new;
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "vec3d.h"
+
+namespace gravity
+{
+	//
+	// Kustaanheimo-Stiefel regularisation of the relative motion of a pair (Stiefel & Scheifele, Linear and
+	// Regular Celestial Mechanics, 1971).
+	//
+	// The relative location x is the image L(u) u of a 4 vector u, and the time is stretched by dt = r ds. The
+	// Kepler problem then becomes a harmonic oscillator in u, u'' = h / 2 u, with no singularity at r = 0, and
+	// the perturbations P (the pull of the other bodies on the relative motion) enter as
+	//
+	//   u'' = h / 2 u + r / 2 L(u)^T P,   h' = 2 u' . L(u)^T P,   t' = u . u
+	//
+	// where h is the Kepler energy per unit of the reduced mass. These are integrated by RK4 in the fictitious
+	// time s. As the physical time goes with r, the steps close in around the pericentre by themselves
+	//
+	class ks_drift
+	{
+		static constexpr int STEPS_PER_OSCILLATION{ 128 };
+		static constexpr int MIN_STEPS{ 32 };
+		static constexpr int MAX_STEPS{ 1 << 20 };
+		static constexpr int MAX_FINAL_ITERATIONS{ 8 };
+		static constexpr double PI{ 3.14159265358979323846 };
+
+		using vec4 = std::array<double, 4>;
+
+		struct state
+		{
+			vec4 u;
+			vec4 w;		// u'
+			double h;
+			double t;
+		};
+
+		static inline vec3d_pd l_times(const vec4& u, const vec4& a) noexcept
+		{
+			return {
+				u[0] * a[0] - u[1] * a[1] - u[2] * a[2] + u[3] * a[3],
+				u[1] * a[0] + u[0] * a[1] - u[3] * a[2] - u[2] * a[3],
+				u[2] * a[0] + u[3] * a[1] + u[0] * a[2] + u[1] * a[3]
+			};
+		}
+
+		static inline vec4 l_transposed_times(const vec4& u, const vec3d_pd& a) noexcept
+		{
+			return {
+				u[0] * a.x() + u[1] * a.y() + u[2] * a.z(),
+				-u[1] * a.x() + u[0] * a.y() + u[3] * a.z(),
+				-u[2] * a.x() - u[3] * a.y() + u[0] * a.z(),
+				u[3] * a.x() - u[2] * a.y() + u[1] * a.z()
+			};
+		}
+
+		static inline double dot(const vec4& a, const vec4& b) noexcept
+		{
+			return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+		}
+
+	public:
+		//
+		// Advances the relative location / velocity of a pair of gravitational parameter mu by dt. perturbation(t, x)
+		// gives the perturbing acceleration of the relative motion at the time t within the step, for the relative
+		// location x. min_r receives the closest approach within the step
+		//
+		template <typename TPerturbation>
+		static void apply(vec3d_pd& x, vec3d_pd& v, double mu, double dt, TPerturbation&& perturbation, double& min_r) noexcept
+		{
+			state y{ to_ks(x, v, mu) };
+
+			const double r0{ dot(y.u, y.u) };
+			min_r = r0;
+
+			// a fraction of the oscillation in u, and of the whole step at the initial distance
+			const double oscillation{ 2.0 * PI / std::sqrt(std::abs(y.h) * 0.5) };
+			const double ds{ std::min(oscillation / STEPS_PER_OSCILLATION, dt / (r0 * MIN_STEPS)) };
+
+			auto derivative = [&](const state& s) noexcept
+			{
+				const double r{ dot(s.u, s.u) };
+				const vec4 lp{ l_transposed_times(s.u, perturbation(s.t, l_times(s.u, s.u))) };
+
+				state d;
+
+				for (int k = 0; k < 4; ++k)
+				{
+					d.u[k] = s.w[k];
+					d.w[k] = 0.5 * s.h * s.u[k] + 0.5 * r * lp[k];
+				}
+
+				d.h = 2.0 * dot(s.w, lp);
+				d.t = r;
+
+				return d;
+			};
+
+			auto rk4 = [&](const state& s, double step) noexcept
+			{
+				auto add = [](const state& a, const state& d, double f) noexcept
+				{
+					state out;
+
+					for (int k = 0; k < 4; ++k)
+					{
+						out.u[k] = a.u[k] + d.u[k] * f;
+						out.w[k] = a.w[k] + d.w[k] * f;
+					}
+
+					out.h = a.h + d.h * f;
+					out.t = a.t + d.t * f;
+
+					return out;
+				};
+
+				const state k1{ derivative(s) };
+				const state k2{ derivative(add(s, k1, step * 0.5)) };
+				const state k3{ derivative(add(s, k2, step * 0.5)) };
+				const state k4{ derivative(add(s, k3, step)) };
+
+				state out{ s };
+
+				for (int k = 0; k < 4; ++k)
+				{
+					out.u[k] += (k1.u[k] + 2.0 * (k2.u[k] + k3.u[k]) + k4.u[k]) * (step / 6.0);
+					out.w[k] += (k1.w[k] + 2.0 * (k2.w[k] + k3.w[k]) + k4.w[k]) * (step / 6.0);
+				}
+
+				out.h += (k1.h + 2.0 * (k2.h + k3.h) + k4.h) * (step / 6.0);
+				out.t += (k1.t + 2.0 * (k2.t + k3.t) + k4.t) * (step / 6.0);
+
+				return out;
+			};
+
+			for (int steps = 0; steps < MAX_STEPS; ++steps)
+			{
+				const state next{ rk4(y, ds) };
+
+				if (next.t >= dt)
+					break;
+
+				y = next;
+				min_r = std::min(min_r, dot(y.u, y.u));
+			}
+
+			// the last step is cut to land on dt, t(s) goes up with r > 0 so Newton's method gets there
+			double last{ (dt - y.t) / std::max(dot(y.u, y.u), std::numeric_limits<double>::min()) };
+			state end{ rk4(y, last) };
+
+			for (int iteration = 0; iteration < MAX_FINAL_ITERATIONS && end.t != dt; ++iteration)
+			{
+				last -= (end.t - dt) / std::max(dot(end.u, end.u), std::numeric_limits<double>::min());
+				end = rk4(y, last);
+			}
+
+			min_r = std::min(min_r, dot(end.u, end.u));
+
+			from_ks(end, x, v);
+		}
+
+	private:
+		static state to_ks(const vec3d_pd& x, const vec3d_pd& v, double mu) noexcept
+		{
+			const double r{ x.modulo() };
+
+			state s{};
+
+			if (x.x() >= 0.0)
+			{
+				s.u[0] = std::sqrt((r + x.x()) * 0.5);
+				s.u[1] = s.u[0] > 0.0 ? x.y() / (2.0 * s.u[0]) : 0.0;
+				s.u[2] = s.u[0] > 0.0 ? x.z() / (2.0 * s.u[0]) : 0.0;
+				s.u[3] = 0.0;
+			}
+			else
+			{
+				s.u[1] = std::sqrt((r - x.x()) * 0.5);
+				s.u[0] = x.y() / (2.0 * s.u[1]);
+				s.u[3] = x.z() / (2.0 * s.u[1]);
+				s.u[2] = 0.0;
+			}
+
+			const vec4 w{ l_transposed_times(s.u, v) };
+
+			for (int k = 0; k < 4; ++k)
+			{
+				s.w[k] = 0.5 * w[k];
+			}
+
+			s.h = 0.5 * vec3d_pd::dot(v, v) - mu / r;
+			s.t = 0.0;
+
+			return s;
+		}
+
+		static void from_ks(const state& s, vec3d_pd& x, vec3d_pd& v) noexcept
+		{
+			const double r{ dot(s.u, s.u) };
+
+			x = l_times(s.u, s.u);
+			v = l_times(s.u, s.w) * (2.0 / r);
+		}
+	};
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// The labels of the bodies, interned so that a body carries a 32-bit id instead of a string. The label of a
+	// merge only records the ids it is made of, and the "a+b+c" text is put together when someone asks for it
+	//
+	class label_table
+	{
+		struct entry
+		{
+			std::string text;
+			std::vector<uint32_t> parts;	// the merged labels, empty for an interned one
+		};
+
+		std::vector<entry> _entries;
+		std::unordered_map<std::string, uint32_t> _ids;
+
+		void append_text(uint32_t id, std::string& out) const
+		{
+			const auto& e{ _entries[id] };
+
+			if (e.parts.empty())
+			{
+				out += e.text;
+				return;
+			}
+
+			for (size_t p = 0; p < e.parts.size(); ++p)
+			{
+				if (p > 0)
+					out += "+";
+				append_text(e.parts[p], out);
+			}
+		}
+
+	public:
+		static constexpr uint32_t NO_LABEL{ 0 };
+		static constexpr uint32_t NOT_FOUND{ UINT32_MAX };
+
+		label_table()
+		{
+			clear();
+		}
+
+		void clear()
+		{
+			_entries.assign(1, entry{});
+			_ids.clear();
+			_ids.emplace(std::string{}, NO_LABEL);
+		}
+
+		uint32_t intern(const std::string& text)
+		{
+			const auto [it, inserted] { _ids.emplace(text, static_cast<uint32_t>(_entries.size())) };
+
+			if (inserted)
+			{
+				_entries.push_back({ text, {} });
+			}
+
+			return it->second;
+		}
+
+		//
+		// Label of the bodies merged together, made of their labels in the given order
+		//
+		template <typename TIds>
+		uint32_t merged(const TIds& parts)
+		{
+			_entries.push_back({ {}, { parts.begin(), parts.end() } });
+			return static_cast<uint32_t>(_entries.size() - 1);
+		}
+
+		//
+		// Id of an interned label, NOT_FOUND when there is none. The labels of the merges are never found
+		//
+		uint32_t find(const std::string& text) const
+		{
+			const auto it{ _ids.find(text) };
+			return it != _ids.end() ? it->second : NOT_FOUND;
+		}
+
+		std::string text(uint32_t id) const
+		{
+			std::string ret;
+			append_text(id, ret);
+			return ret;
+		}
+
+		void text(uint32_t id, std::string& out) const
+		{
+			out.clear();
+			append_text(id, out);
+		}
+
+		//
+		// Drops the entries that none of the given labels uses, directly or as a part of a merge, and renumbers the
+		// given labels to match. The merges only ever add entries, so this goes with the compactions of the bodies
+		//
+		template <typename TIds>
+		void compact(TIds& ids)
+		{
+			std::vector<uint32_t> remap(_entries.size(), NOT_FOUND);
+			remap[NO_LABEL] = NO_LABEL;
+
+			std::vector<uint32_t> pending{ ids.begin(), ids.end() };
+
+			while (!pending.empty())
+			{
+				const uint32_t id{ pending.back() };
+				pending.pop_back();
+
+				if (remap[id] != NOT_FOUND)
+					continue;
+
+				remap[id] = 0;	// reached, numbered below
+				pending.insert(pending.end(), _entries[id].parts.begin(), _entries[id].parts.end());
+			}
+
+			// the parts are always older than their merges, so the order of the entries stays valid
+			uint32_t kept{ 1 };
+
+			for (uint32_t id = 1; id < _entries.size(); ++id)
+			{
+				if (remap[id] == NOT_FOUND)
+					continue;
+
+				remap[id] = kept;
+
+				for (auto& part : _entries[id].parts)
+				{
+					part = remap[part];
+				}
+
+				if (kept != id)
+				{
+					_entries[kept] = std::move(_entries[id]);
+				}
+
+				++kept;
+			}
+
+			_entries.resize(kept);
+
+			for (auto it = _ids.begin(); it != _ids.end(); )
+			{
+				if (remap[it->second] == NOT_FOUND)
+				{
+					it = _ids.erase(it);
+				}
+				else
+				{
+					it->second = remap[it->second];
+					++it;
+				}
+			}
+
+			for (auto& id : ids)
+			{
+				id = remap[id];
+			}
+		}
+	};
+}
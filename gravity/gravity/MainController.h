@@ -121,6 +121,19 @@ namespace gravity
         void Start() override
         {
 			world.set_time_delta(config.time_delta());
+			world.set_tolerance(config.tolerance());
+			world.set_force_split(config.respa_substeps(), config.respa_cutoff());
+			world.set_collision_interval(config.collision_interval());
+			world.set_num_worker_threads(config.num_worker_thrads());
+			world.set_force_kernel(config.get_force_kernel());
+			if (config.get_force_kernel() == force_kernel::tiled)
+			{
+				world.set_tile_shape(tile_autotuner::load_or_tune(config.tile_cache_file()));
+			}
+			world.set_force_engine(config.get_force_engine());
+			world.set_tree_opening_angle(config.tree_opening_angle());
+			world.set_tree_quadrupole(config.tree_quadrupole());
+			world.set_fmm_order(config.fmm_order());
 			world.set_output_csv(config.output_file());
 			world.set_report_centre(config.report_centre());
 			world.set_report_every(config.report_every_n());
@@ -149,7 +162,7 @@ namespace gravity
         void CalcThread()
         {
             auto lastUIUpdate = std::chrono::high_resolution_clock::now();
-			int64_t last_update_at{ 0 };
+			double last_update_at{ 0.0 };
 
 			if (config.auto_star())
 			{
@@ -178,9 +191,9 @@ namespace gravity
 
 					if (sinceLastUpdate.count() > 1.0 / 30.0 || recording)
 					{						
-						viewDetails.timeRate = config.time_delta() * (world.current_iteration() - last_update_at) / static_cast<double>(sinceLastUpdate.count()); // seconds per second 
+						viewDetails.timeRate = (world.simulation_time() - last_update_at) / static_cast<double>(sinceLastUpdate.count()); // seconds per second 
 						lastUIUpdate = now;
-						last_update_at = world.current_iteration();
+						last_update_at = world.simulation_time();
 
 						uiNeedsUpdate = true;
 						::SendMessage(hWND, WM_USER, 0, 0);
@@ -201,6 +214,7 @@ namespace gravity
 				}
 
 				viewDetails.epochTimeUTCMillis = world.current_time_epoch_millis();
+				viewDetails.stepAllocations = world.step_allocations();
             }
         }
 
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <cmath>
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+
+namespace gravity
+{
+	//
+	// Octree over the positions of a single generation, shared by the tree based force engines.
+	//
+	// Nodes are stored in depth-first pre-order, so the first child of a node is always the next node, and "next"
+	// points past the whole subtree - this makes the walks stackless, and guarantees that iterating the nodes
+	// backwards visits the children before their parent. Bodies are copied into the tree order, so the leaves are
+	// contiguous in memory as well.
+	//
+	class octree
+	{
+	public:
+		static constexpr int DEFAULT_LEAF_SIZE{ 8 };
+		static constexpr int MAX_DEPTH{ 48 };
+
+		struct node
+		{
+			vec3d_pd centre{};		// geometric centre of the cell
+			vec3d_pd com{};			// centre of mass
+			double half_size{};
+			double mass_G{};
+			double b_max{};			// radius of the sphere around com that encloses all the bodies of the cell
+
+			int begin{};			// range of the bodies in the tree order
+			int end{};
+			int next{};				// index of the node after this subtree
+			bool leaf{};
+		};
+
+	private:
+		std::vector<node> _nodes;
+
+		std::vector<int> _index;			// tree order -> body index
+		std::vector<int> _scratch;
+
+		hot_vector<double> _x;
+		hot_vector<double> _y;
+		hot_vector<double> _z;
+		hot_vector<double> _mass_G;
+		hot_vector<double> _radius;
+
+		int _leaf_size{ DEFAULT_LEAF_SIZE };
+
+	public:
+		void set_leaf_size(int leaf_size) noexcept
+		{
+			_leaf_size = leaf_size;
+		}
+
+		inline int size() const noexcept
+		{
+			return static_cast<int>(_index.size());
+		}
+
+		// body index of the k-th body in the tree order
+		inline int body_at(int k) const noexcept
+		{
+			return _index[k];
+		}
+
+		inline const std::vector<node>& nodes() const noexcept
+		{
+			return _nodes;
+		}
+
+		inline vec3d_pd location(int k) const noexcept
+		{
+			return { _x[k], _y[k], _z[k] };
+		}
+
+		inline double mass_G(int k) const noexcept
+		{
+			return _mass_G[k];
+		}
+
+		inline static bool contains(const node& nd, const vec3d_pd& loc) noexcept
+		{
+			const auto d{ loc - nd.centre };
+			return std::abs(d.x()) <= nd.half_size && std::abs(d.y()) <= nd.half_size && std::abs(d.z()) <= nd.half_size;
+		}
+
+		void build(const body_generation& generation, const body_properties& props)
+		{
+			const int num_bodies{ static_cast<int>(generation.size()) };
+
+			_nodes.clear();
+			_index.resize(num_bodies);
+			_scratch.resize(num_bodies);
+
+			if (num_bodies == 0)
+				return;
+
+			vec3d_pd lo{ generation.x[0], generation.y[0], generation.z[0] };
+			vec3d_pd hi{ lo };
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				_index[i] = i;
+
+				lo.x() = std::min(lo.x(), generation.x[i]);
+				lo.y() = std::min(lo.y(), generation.y[i]);
+				lo.z() = std::min(lo.z(), generation.z[i]);
+				hi.x() = std::max(hi.x(), generation.x[i]);
+				hi.y() = std::max(hi.y(), generation.y[i]);
+				hi.z() = std::max(hi.z(), generation.z[i]);
+			}
+
+			const auto extent{ hi - lo };
+			const double half_size{ std::max({ extent.x(), extent.y(), extent.z(), 1.0 }) * 0.5 * 1.0001 };
+
+			build_node(generation, (lo + hi) * 0.5, half_size, 0, num_bodies, 0);
+
+			_x.resize(num_bodies);
+			_y.resize(num_bodies);
+			_z.resize(num_bodies);
+			_mass_G.resize(num_bodies);
+			_radius.resize(num_bodies);
+
+			for (int k = 0; k < num_bodies; ++k)
+			{
+				const auto idx{ _index[k] };
+				_x[k] = generation.x[idx];
+				_y[k] = generation.y[idx];
+				_z[k] = generation.z[idx];
+				_mass_G[k] = props.mass_G[idx];
+				_radius[k] = props.radius[idx];
+			}
+
+			compute_monopoles();
+		}
+
+		//
+		// Direct pull of the bodies of the given leaf onto the k-th body (in the tree order). This is where the collisions
+		// and the tidal heating are detected: on_collision(j) receives the body index, not the tree order
+		//
+		template <typename TOnCollision, typename TOnTidalHeating>
+		inline vec3d_pd leaf_pull(int k, const node& leaf, TOnCollision&& on_collision, TOnTidalHeating&& on_tidal_heating) const noexcept
+		{
+			const vec3d_pd loc{ _x[k], _y[k], _z[k] };
+			const double radius{ _radius[k] };
+
+			vec3d_pd acc{ 0.0, 0.0, 0.0 };
+
+			for (int j = leaf.begin; j < leaf.end; ++j)
+			{
+				if (j == k)
+					continue;
+
+				auto r_ba = vec3d_pd{ _x[j], _y[j], _z[j] } - loc;
+				auto r_modulo = r_ba.modulo();
+
+				if (r_modulo > radius + _radius[j])
+				{
+					acc += r_ba * (_mass_G[j] / (r_modulo * r_modulo * r_modulo));
+
+					if (r_modulo < radius * 10)
+					{
+						on_tidal_heating();
+					}
+				}
+				else
+				{
+					on_collision(_index[j]);
+				}
+			}
+
+			return acc;
+		}
+
+	private:
+		static int octant_of(const body_generation& generation, int idx, const vec3d_pd& centre) noexcept
+		{
+			return (generation.x[idx] >= centre.x() ? 1 : 0)
+				| (generation.y[idx] >= centre.y() ? 2 : 0)
+				| (generation.z[idx] >= centre.z() ? 4 : 0);
+		}
+
+		void build_node(const body_generation& generation, const vec3d_pd& centre, double half_size, int begin, int end, int depth)
+		{
+			const int node_idx{ static_cast<int>(_nodes.size()) };
+
+			_nodes.push_back({});
+			{
+				auto& nd{ _nodes.back() };
+				nd.centre = centre;
+				nd.half_size = half_size;
+				nd.begin = begin;
+				nd.end = end;
+				nd.leaf = (end - begin) <= _leaf_size || depth >= MAX_DEPTH;
+			}
+
+			if (!_nodes[node_idx].leaf)
+			{
+				// counting sort of the range by octant
+				std::array<int, 9> offsets{};
+
+				for (int k = begin; k < end; ++k)
+				{
+					offsets[octant_of(generation, _index[k], centre) + 1]++;
+				}
+
+				for (int o = 0; o < 8; ++o)
+				{
+					offsets[o + 1] += offsets[o];
+				}
+
+				auto cursor{ offsets };
+				for (int k = begin; k < end; ++k)
+				{
+					const auto idx{ _index[k] };
+					_scratch[begin + cursor[octant_of(generation, idx, centre)]++] = idx;
+				}
+
+				std::copy(_scratch.begin() + begin, _scratch.begin() + end, _index.begin() + begin);
+
+				const double child_half{ half_size * 0.5 };
+
+				for (int o = 0; o < 8; ++o)
+				{
+					if (offsets[o] == offsets[o + 1])
+						continue;
+
+					const vec3d_pd child_centre{
+						centre.x() + ((o & 1) ? child_half : -child_half),
+						centre.y() + ((o & 2) ? child_half : -child_half),
+						centre.z() + ((o & 4) ? child_half : -child_half)
+					};
+
+					build_node(generation, child_centre, child_half, begin + offsets[o], begin + offsets[o + 1], depth + 1);
+				}
+			}
+
+			_nodes[node_idx].next = static_cast<int>(_nodes.size());
+		}
+
+		//
+		// Bottom-up pass (children are always after the parent): mass, centre of mass and b_max
+		//
+		void compute_monopoles() noexcept
+		{
+			for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; --n)
+			{
+				auto& nd{ _nodes[n] };
+
+				vec3d_pd mass_loc{ 0.0, 0.0, 0.0 };
+				double mass_G{ 0.0 };
+
+				if (nd.leaf)
+				{
+					for (int k = nd.begin; k < nd.end; ++k)
+					{
+						mass_loc += location(k) * _mass_G[k];
+						mass_G += _mass_G[k];
+					}
+				}
+				else
+				{
+					for (int child = n + 1; child < nd.next; child = _nodes[child].next)
+					{
+						mass_loc += _nodes[child].com * _nodes[child].mass_G;
+						mass_G += _nodes[child].mass_G;
+					}
+				}
+
+				nd.mass_G = mass_G;
+				nd.com = mass_G > 0 ? mass_loc / mass_G : nd.centre;
+				nd.b_max = 0.0;
+
+				if (nd.leaf)
+				{
+					for (int k = nd.begin; k < nd.end; ++k)
+					{
+						nd.b_max = std::max(nd.b_max, (location(k) - nd.com).modulo() + _radius[k]);
+					}
+				}
+				else
+				{
+					for (int child = n + 1; child < nd.next; child = _nodes[child].next)
+					{
+						nd.b_max = std::max(nd.b_max, (_nodes[child].com - nd.com).modulo() + _nodes[child].b_max);
+					}
+				}
+			}
+		}
+	};
+}
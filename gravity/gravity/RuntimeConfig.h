@@ -13,19 +13,39 @@ namespace gravity
     class runtime_config
     {
         double _time_delta{ 1 };
+        double _tolerance{ 1e-12 };
+
+        int _respa_substeps{ 8 };
+        double _respa_cutoff{ 0.0 };
+
+        int _collision_interval{ 1 };
 
         uint64_t _report_every_n{ 1000 };
         uint64_t _max_n{ std::numeric_limits<uint64_t>::max() };
 
-        int _num_worker_threads{ 1 }; // would be more more flexible in the future.. 
+        int _num_worker_threads{ 1 };
         
         std::string _input_file{};
         std::string _output_file{};
+        std::string _batch_manifest{};
+        bool _batch_ensemble{ false };
 
         bool _auto_start{ false };
 
         integration_method method{ integration_method::cubic_kahan };
 
+        force_kernel _force_kernel{ force_kernel::scalar };
+        force_engine _force_engine{ force_engine::direct };
+
+        double _tree_opening_angle{ 0.5 };
+        bool _tree_quadrupole{ false };
+
+        bool _huge_pages{ false };
+        bool _first_touch{ false };
+        int _fmm_order{ 4 };
+
+        std::string _tile_cache_file{ tile_autotuner::default_cache_file() };
+
         std::string _report_centre{};
 
     public:
@@ -62,7 +82,14 @@ namespace gravity
             return
                 L"Usage:\r\n"
                 L"gravity.exe [--input <input_file.csv>] [--output <output.csv>] [options]\r\n"
+                L"gravity.exe --batch <manifest.csv> --duration <simulated_seconds> [options]\r\n"
+                L"bodies of zero mass in <input_file.csv> are test particles: they feel the rest, but pull on nothing\r\n"
                 L"options are:\r\n"
+                L"  --batch <manifest.csv>\r\n" L"    run all the scenarios of the manifest without the UI, the manifest header is\r\n"
+                L"    name,input,output,runs,seed,location_sigma_km,velocity_sigma_kms,mass_sigma\r\n"
+                L"  --ensemble\r\n" L"    step the runs of a batch scenario together, one per SIMD lane, direct engine and methods 0 - 5 only.\r\n"
+                L"    Collisions are not merged: a run stops reporting at its first collision, and <output>_<run>.collided.csv\r\n"
+                L"    gives the iteration\r\n"
                 L"  --report-centre <name>\r\n" L"    name of the body to use as a base for report coordinate system\r\n"
                 L"  --time-delta <time_delta_seconds>\r\n" L"    default is 1.0, supports float values\r\n"
                 L"  --report-every <simulated_seconds>\r\n" L"    report into <output.csv> every given simulated period\r\n"
@@ -76,6 +103,35 @@ namespace gravity
                 L"    3 - quadratic_kahan\r\n"
                 L"    4 - cubic\r\n"
                 L"    5 - cubic_kahan [DEFAULT]\r\n" 
+                L"    6 - leapfrog, symplectic 2nd order\r\n"
+                L"    7 - yoshida4, symplectic 4th order, 3 force evaluations per step\r\n"
+                L"    8 - yoshida6, symplectic 6th order, 7 force evaluations per step\r\n"
+                L"    9 - wisdom_holman, symplectic, for systems dominated by their most massive body\r\n"
+                L"    10 - bulirsch_stoer, adaptive steps starting from <time_delta_seconds>\r\n"
+                L"    11 - block_steps, individual steps per body, <time_delta_seconds> is the longest, direct force engine only\r\n"
+                L"    12 - hermite4, 4th order Hermite with individual steps per body as above\r\n"
+                L"    13 - respa, near pairs by leapfrog in substeps, far pairs once per <time_delta_seconds>, direct force engine only\r\n"
+                L"    14 - hierarchical, planets with the moons in their Hill spheres in their own frames at their own substeps, the rest at <time_delta_seconds>, direct force engine only\r\n"
+                L"    15 - ks_regularized, leapfrog at <time_delta_seconds>, the tight pairs by Kustaanheimo-Stiefel regularisation of their relative motion, direct force engine only\r\n"
+                L"  --tolerance <relative_error>\r\n" L"    error per step the adaptive methods aim for, default is 1e-12, much below that the steps only get shorter\r\n"
+                L"  --respa-substeps <k>\r\n" L"    substeps of the near pairs per <time_delta_seconds>, default is 8\r\n"
+                L"  --respa-cutoff <meters>\r\n" L"    pairs closer than this are near, default is 0 - a planet and the moons in its Hill sphere, and the pairs with the central body\r\n"
+                L"  --collision-every <k>\r\n" L"    steps between the collision checks, the paths in between are taken as straight, default is 1\r\n"
+                L"  --threads <n>\r\n" L"    number of worker threads, default is the number of processors\r\n"
+                L"  --force-kernel <kernel>\r\n" L"    Force kernel used by the multithreaded path\r\n"
+                L"    0 - scalar [DEFAULT]\r\n"
+                L"    1 - simd, AVX2 / AVX-512 builds only\r\n"
+                L"    2 - tiled, tile sizes are tuned on the first run and cached\r\n"
+                L"  --tile-cache <file>\r\n" L"    where to cache the tuned tile sizes, default is gravity_tiles.cfg in the temp folder\r\n"
+                L"  --force-engine <engine>\r\n" L"    Algorithm used to evaluate the gravity forces\r\n"
+                L"    0 - direct O(N^2) summation [DEFAULT]\r\n"
+                L"    1 - Barnes-Hut octree\r\n"
+                L"    2 - fast multipole method\r\n"
+                L"  --theta <opening_angle>\r\n" L"    Barnes-Hut / FMM opening angle, default is 0.5\r\n"
+                L"  --quadrupole\r\n" L"    add quadrupole moments to the Barnes-Hut cells\r\n"
+                L"  --fmm-order <p>\r\n" L"    FMM expansion order, 1 to 10, default is 4\r\n"
+                L"  --huge-pages\r\n" L"    put the body arrays of 2 MB and more on 2 MB huge pages\r\n"
+                L"  --first-touch\r\n" L"    first touch the body arrays from the worker threads, so their pages are on the NUMA nodes of the threads\r\n"
                 ;
         }
 
@@ -104,6 +160,11 @@ namespace gravity
                     _output_file = wcs2mbs(argv[idx + 1]);
                     idx++;
                 }
+                else if (wcscmp(argv[idx], L"--batch") == 0 && (idx + 1) < argc)
+                {
+                    _batch_manifest = wcs2mbs(argv[idx + 1]);
+                    idx++;
+                }
                 else if (wcscmp(argv[idx], L"--report-centre") == 0 && (idx + 1) < argc)
                 {
                     _report_centre = wcs2mbs(argv[idx + 1]);
@@ -114,6 +175,46 @@ namespace gravity
                     _time_delta = std::stod(std::wstring{ argv[idx + 1] });
                     idx++;
                 }
+                else if (wcscmp(argv[idx], L"--tolerance") == 0 && (idx + 1) < argc)
+                {
+                    _tolerance = std::stod(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_tolerance <= 0.0)
+                    {
+                        return false;
+                    }
+                }
+                else if (wcscmp(argv[idx], L"--respa-substeps") == 0 && (idx + 1) < argc)
+                {
+                    _respa_substeps = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_respa_substeps < 1)
+                    {
+                        return false;
+                    }
+                }
+                else if (wcscmp(argv[idx], L"--respa-cutoff") == 0 && (idx + 1) < argc)
+                {
+                    _respa_cutoff = std::stod(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_respa_cutoff < 0.0)
+                    {
+                        return false;
+                    }
+                }
+                else if (wcscmp(argv[idx], L"--collision-every") == 0 && (idx + 1) < argc)
+                {
+                    _collision_interval = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_collision_interval < 1)
+                    {
+                        return false;
+                    }
+                }
                 else if (wcscmp(argv[idx], L"--report-every") == 0 && (idx + 1) < argc)
                 {
                     report_every_n_seconds = std::stoull(std::wstring{ argv[idx + 1] });
@@ -134,13 +235,95 @@ namespace gravity
                     idx++;
 
                     if (m < static_cast<int>(integration_method::linear) ||
-                        m > static_cast<int>(integration_method::cubic_kahan))
+                        m > static_cast<int>(integration_method::ks_regularized))
                     {
                         return false;
                     }
 
                     method = static_cast<integration_method>(m);
                 }
+                else if (wcscmp(argv[idx], L"--threads") == 0 && (idx + 1) < argc)
+                {
+                    _num_worker_threads = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_num_worker_threads < 1)
+                    {
+                        return false;
+                    }
+                }
+                else if (wcscmp(argv[idx], L"--force-kernel") == 0 && (idx + 1) < argc)
+                {
+                    int k = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (k < static_cast<int>(force_kernel::scalar) ||
+                        k > static_cast<int>(force_kernel::tiled))
+                    {
+                        return false;
+                    }
+
+                    if (k == static_cast<int>(force_kernel::simd) && !SIMD_FORCE_KERNEL_AVAILABLE)
+                    {
+                        return false;
+                    }
+
+                    _force_kernel = static_cast<force_kernel>(k);
+                }
+                else if (wcscmp(argv[idx], L"--tile-cache") == 0 && (idx + 1) < argc)
+                {
+                    _tile_cache_file = wcs2mbs(argv[idx + 1]);
+                    idx++;
+                }
+                else if (wcscmp(argv[idx], L"--force-engine") == 0 && (idx + 1) < argc)
+                {
+                    int e = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (e < static_cast<int>(force_engine::direct) ||
+                        e > static_cast<int>(force_engine::fmm))
+                    {
+                        return false;
+                    }
+
+                    _force_engine = static_cast<force_engine>(e);
+                }
+                else if (wcscmp(argv[idx], L"--theta") == 0 && (idx + 1) < argc)
+                {
+                    _tree_opening_angle = std::stod(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_tree_opening_angle <= 0.0)
+                    {
+                        return false;
+                    }
+                }
+                else if (wcscmp(argv[idx], L"--quadrupole") == 0)
+                {
+                    _tree_quadrupole = true;
+                }
+                else if (wcscmp(argv[idx], L"--huge-pages") == 0)
+                {
+                    _huge_pages = true;
+                }
+                else if (wcscmp(argv[idx], L"--first-touch") == 0)
+                {
+                    _first_touch = true;
+                }
+                else if (wcscmp(argv[idx], L"--ensemble") == 0)
+                {
+                    _batch_ensemble = true;
+                }
+                else if (wcscmp(argv[idx], L"--fmm-order") == 0 && (idx + 1) < argc)
+                {
+                    _fmm_order = std::stoi(std::wstring{ argv[idx + 1] });
+                    idx++;
+
+                    if (_fmm_order < fmm_solver::MIN_ORDER || _fmm_order > fmm_solver::MAX_ORDER)
+                    {
+                        return false;
+                    }
+                }
                 else
                 {
                     return false;
@@ -153,6 +336,21 @@ namespace gravity
             {
                 _max_n = static_cast<uint64_t>(std::round(static_cast<double>(duration) / _time_delta));
             }
+            else if (!_batch_manifest.empty())
+            {
+                // batch runs have nobody to stop them
+                return false;
+            }
+
+            if (_batch_ensemble && (_batch_manifest.empty() || _force_engine != force_engine::direct || uses_kick_drift(method)))
+            {
+                return false;
+            }
+
+            if ((has_block_steps(method) || has_force_split(method)) && _force_engine != force_engine::direct)
+            {
+                return false;
+            }
 
             return true;
         }
@@ -162,6 +360,46 @@ namespace gravity
             return method;
         }
 
+        inline force_kernel get_force_kernel() const noexcept
+        {
+            return _force_kernel;
+        }
+
+        inline const std::string& tile_cache_file() const noexcept
+        {
+            return _tile_cache_file;
+        }
+
+        inline force_engine get_force_engine() const noexcept
+        {
+            return _force_engine;
+        }
+
+        inline double tree_opening_angle() const noexcept
+        {
+            return _tree_opening_angle;
+        }
+
+        inline bool tree_quadrupole() const noexcept
+        {
+            return _tree_quadrupole;
+        }
+
+        inline bool huge_pages() const noexcept
+        {
+            return _huge_pages;
+        }
+
+        inline bool first_touch() const noexcept
+        {
+            return _first_touch;
+        }
+
+        inline int fmm_order() const noexcept
+        {
+            return _fmm_order;
+        }
+
         inline int num_worker_thrads() const noexcept 
         {
             return _num_worker_threads;
@@ -172,6 +410,26 @@ namespace gravity
             return _time_delta;
         }       
 
+        inline double tolerance() const noexcept
+        {
+            return _tolerance;
+        }
+
+        inline int respa_substeps() const noexcept
+        {
+            return _respa_substeps;
+        }
+
+        inline double respa_cutoff() const noexcept
+        {
+            return _respa_cutoff;
+        }
+
+        inline int collision_interval() const noexcept
+        {
+            return _collision_interval;
+        }
+
         inline uint64_t report_every_n() const noexcept
         {
             return _report_every_n;
@@ -192,6 +450,16 @@ namespace gravity
             return _output_file;
         }
 
+        inline const std::string& batch_manifest() const noexcept
+        {
+            return _batch_manifest;
+        }
+
+        inline bool batch_ensemble() const noexcept
+        {
+            return _batch_ensemble;
+        }
+
         inline const std::string& report_centre() const noexcept
         {
             return _report_centre;
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include "vec3d.h"
+
+namespace gravity
+{
+	//
+	// Pull of a set of bodies onto a single body "i", as accumulated by the SIMD force kernel
+	//
+	struct simd_pull
+	{
+		vec3d_pd acceleration{};
+		bool tidal_heating{ false };
+	};
+
+#if defined(AVX512)
+
+	static constexpr bool SIMD_FORCE_KERNEL_AVAILABLE{ true };
+	static constexpr int SIMD_FORCE_KERNEL_LANES{ 8 };
+
+	//
+	// Broadcasts body i and processes 8 source bodies per instruction.
+	// 1/r^3 is calculated via rsqrt14 followed by two Newton-Raphson steps, which brings it to the full double precision.
+	// Tails are handled with masked loads, colliding pairs are masked out of the sum and left to broad_phase
+	//
+	inline simd_pull simd_body_pull(
+		int i,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* mass_G,
+		const double* radius
+	) noexcept
+	{
+		const __m512d xi{ _mm512_set1_pd(x[i]) };
+		const __m512d yi{ _mm512_set1_pd(y[i]) };
+		const __m512d zi{ _mm512_set1_pd(z[i]) };
+		const __m512d ri{ _mm512_set1_pd(radius[i]) };
+		const __m512d tidal_r2{ _mm512_set1_pd(radius[i] * radius[i] * 100.0) };
+
+		const __m512d one_half{ _mm512_set1_pd(0.5) };
+		const __m512d three_halves{ _mm512_set1_pd(1.5) };
+
+		__m512d ax{ _mm512_setzero_pd() };
+		__m512d ay{ _mm512_setzero_pd() };
+		__m512d az{ _mm512_setzero_pd() };
+
+		__mmask8 heat{ 0 };
+
+		auto process = [&](int j, __mmask8 mask) noexcept
+		{
+			const __m512d dx{ _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + j), xi) };
+			const __m512d dy{ _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, y + j), yi) };
+			const __m512d dz{ _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, z + j), zi) };
+
+			const __m512d r2{ _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz))) };
+
+			const __m512d r_sum{ _mm512_add_pd(_mm512_maskz_loadu_pd(mask, radius + j), ri) };
+
+			const __mmask8 collide{ _mm512_mask_cmp_pd_mask(mask, r2, _mm512_mul_pd(r_sum, r_sum), _CMP_LE_OQ) };
+			const __mmask8 live = mask & ~collide;
+
+			heat |= _mm512_mask_cmp_pd_mask(live, r2, tidal_r2, _CMP_LT_OQ);
+
+			__m512d inv_r{ _mm512_maskz_rsqrt14_pd(live, r2) };
+			const __m512d half_r2{ _mm512_mul_pd(r2, one_half) };
+
+			inv_r = _mm512_mul_pd(inv_r, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv_r, inv_r), three_halves));
+			inv_r = _mm512_mul_pd(inv_r, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv_r, inv_r), three_halves));
+
+			const __m512d inv_r3{ _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r)) };
+			const __m512d s{ _mm512_maskz_mul_pd(live, _mm512_maskz_loadu_pd(live, mass_G + j), inv_r3) };
+
+			ax = _mm512_fmadd_pd(dx, s, ax);
+			ay = _mm512_fmadd_pd(dy, s, ay);
+			az = _mm512_fmadd_pd(dz, s, az);
+		};
+
+		auto process_range = [&](int j_begin, int j_end) noexcept
+		{
+			int j = j_begin;
+			for (; j + SIMD_FORCE_KERNEL_LANES <= j_end; j += SIMD_FORCE_KERNEL_LANES)
+			{
+				process(j, 0xff);
+			}
+
+			if (j < j_end)
+			{
+				process(j, static_cast<__mmask8>((1u << (j_end - j)) - 1));
+			}
+		};
+
+		process_range(0, i);
+		process_range(i + 1, num_bodies);
+
+		return {
+			{ _mm512_reduce_add_pd(ax), _mm512_reduce_add_pd(ay), _mm512_reduce_add_pd(az) },
+			heat != 0
+		};
+	}
+
+#elif defined(AVX2)
+
+	static constexpr bool SIMD_FORCE_KERNEL_AVAILABLE{ true };
+	static constexpr int SIMD_FORCE_KERNEL_LANES{ 4 };
+
+	inline double simd_hsum(__m256d v) noexcept
+	{
+		const __m128d s{ _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)) };
+		return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+	}
+
+	//
+	// Broadcasts body i and processes 4 source bodies per instruction, using FMA and packed sqrt / div.
+	// Tails are handled with masked loads, colliding pairs are masked out of the sum and left to broad_phase
+	//
+	inline simd_pull simd_body_pull(
+		int i,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* mass_G,
+		const double* radius
+	) noexcept
+	{
+		const __m256d xi{ _mm256_set1_pd(x[i]) };
+		const __m256d yi{ _mm256_set1_pd(y[i]) };
+		const __m256d zi{ _mm256_set1_pd(z[i]) };
+		const __m256d ri{ _mm256_set1_pd(radius[i]) };
+		const __m256d tidal_r{ _mm256_set1_pd(radius[i] * 10.0) };
+		const __m256d one{ _mm256_set1_pd(1.0) };
+
+		const __m256i lane_idx{ _mm256_setr_epi64x(0, 1, 2, 3) };
+
+		__m256d ax{ _mm256_setzero_pd() };
+		__m256d ay{ _mm256_setzero_pd() };
+		__m256d az{ _mm256_setzero_pd() };
+
+		__m256d heat{ _mm256_setzero_pd() };
+
+		auto process = [&](int j, __m256i mask_i) noexcept
+		{
+			const __m256d mask{ _mm256_castsi256_pd(mask_i) };
+
+			const __m256d dx{ _mm256_sub_pd(_mm256_maskload_pd(x + j, mask_i), xi) };
+			const __m256d dy{ _mm256_sub_pd(_mm256_maskload_pd(y + j, mask_i), yi) };
+			const __m256d dz{ _mm256_sub_pd(_mm256_maskload_pd(z + j, mask_i), zi) };
+
+			const __m256d r2{ _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz))) };
+			const __m256d r{ _mm256_sqrt_pd(r2) };
+
+			const __m256d r_sum{ _mm256_add_pd(_mm256_maskload_pd(radius + j, mask_i), ri) };
+
+			const __m256d collide{ _mm256_and_pd(mask, _mm256_cmp_pd(r, r_sum, _CMP_LE_OQ)) };
+			const __m256d live{ _mm256_andnot_pd(collide, mask) };
+
+			heat = _mm256_or_pd(heat, _mm256_and_pd(live, _mm256_cmp_pd(r, tidal_r, _CMP_LT_OQ)));
+
+			// dead lanes divide by 1.0 instead of a potential zero, and are masked out right after
+			const __m256d r3{ _mm256_blendv_pd(one, _mm256_mul_pd(r2, r), live) };
+			const __m256d s{ _mm256_and_pd(live, _mm256_div_pd(_mm256_maskload_pd(mass_G + j, mask_i), r3)) };
+
+			ax = _mm256_fmadd_pd(dx, s, ax);
+			ay = _mm256_fmadd_pd(dy, s, ay);
+			az = _mm256_fmadd_pd(dz, s, az);
+		};
+
+		auto process_range = [&](int j_begin, int j_end) noexcept
+		{
+			const __m256i all{ _mm256_set1_epi64x(-1) };
+
+			int j = j_begin;
+			for (; j + SIMD_FORCE_KERNEL_LANES <= j_end; j += SIMD_FORCE_KERNEL_LANES)
+			{
+				process(j, all);
+			}
+
+			if (j < j_end)
+			{
+				process(j, _mm256_cmpgt_epi64(_mm256_set1_epi64x(j_end - j), lane_idx));
+			}
+		};
+
+		process_range(0, i);
+		process_range(i + 1, num_bodies);
+
+		return {
+			{ simd_hsum(ax), simd_hsum(ay), simd_hsum(az) },
+			_mm256_movemask_pd(heat) != 0
+		};
+	}
+
+#else
+
+	// No packed kernel for the plain AVX / SSE builds - gravity_struct keeps using the scalar one
+	static constexpr bool SIMD_FORCE_KERNEL_AVAILABLE{ false };
+	static constexpr int SIMD_FORCE_KERNEL_LANES{ 1 };
+
+	inline simd_pull simd_body_pull(int, int, const double*, const double*, const double*, const double*, const double*) noexcept
+	{
+		return {};
+	}
+
+#endif
+}
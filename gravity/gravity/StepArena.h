@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// Monotonic scratch memory of a single step: allocations only bump a pointer, nothing is freed until reset().
+	// A step that outgrows the slab gets more slabs, and the next reset() replaces them with one that fits the whole
+	// step, so in the steady state the steps do not touch the heap at all
+	//
+	class step_arena
+	{
+		static constexpr size_t MIN_SLAB_SIZE{ 64 * 1024 };
+
+		struct slab
+		{
+			std::unique_ptr<std::byte[]> memory;
+			size_t size{ 0 };
+		};
+
+		std::vector<slab> _slabs;
+		size_t _used{ 0 };		// of the last slab
+
+		void add_slab(size_t size)
+		{
+			size = std::max(size, MIN_SLAB_SIZE);
+
+			_slabs.push_back({ std::make_unique<std::byte[]>(size), size });
+			_used = 0;
+		}
+
+	public:
+		void* allocate(size_t bytes, size_t alignment)
+		{
+			if (!_slabs.empty())
+			{
+				const auto& last{ _slabs.back() };
+
+				const auto base{ reinterpret_cast<uintptr_t>(last.memory.get()) };
+				const size_t offset{ ((base + _used + alignment - 1) & ~(alignment - 1)) - base };
+
+				if (offset + bytes <= last.size)
+				{
+					_used = offset + bytes;
+					return last.memory.get() + offset;
+				}
+			}
+
+			add_slab(std::max(bytes + alignment, _slabs.empty() ? 0 : _slabs.back().size * 2));
+
+			return allocate(bytes, alignment);
+		}
+
+		//
+		// Drops everything allocated since the last reset
+		//
+		void reset()
+		{
+			if (_slabs.size() > 1)
+			{
+				size_t total{ 0 };
+				for (const auto& s : _slabs)
+				{
+					total += s.size;
+				}
+
+				_slabs.clear();
+				add_slab(total);
+			}
+
+			_used = 0;
+		}
+	};
+
+	//
+	// One arena per worker of a work_stealing_pool, each on its own cache lines, so the workers take their scratch
+	// memory with no locks and no false sharing
+	//
+	class step_arenas
+	{
+		struct alignas(64) worker_arena
+		{
+			step_arena arena;
+		};
+
+		std::vector<worker_arena> _arenas;
+
+	public:
+		explicit step_arenas(int num_workers)
+			: _arenas(std::max(1, num_workers))
+		{
+		}
+
+		//
+		// Must not be called while the workers use their arenas
+		//
+		void resize(int num_workers)
+		{
+			_arenas.resize(std::max(1, num_workers));
+		}
+
+		inline step_arena& operator[](int worker) noexcept
+		{
+			return _arenas[worker].arena;
+		}
+
+		void reset()
+		{
+			for (auto& a : _arenas)
+			{
+				a.arena.reset();
+			}
+		}
+	};
+
+	//
+	// The standard allocator interface over a step_arena, deallocate is a no-op
+	//
+	template <typename T>
+	class arena_allocator
+	{
+		step_arena* _arena;
+
+	public:
+		using value_type = T;
+
+		explicit arena_allocator(step_arena& arena) noexcept
+			: _arena{ &arena }
+		{
+		}
+
+		template <typename U>
+		arena_allocator(const arena_allocator<U>& other) noexcept
+			: _arena{ other.arena() }
+		{
+		}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T*, size_t) noexcept
+		{
+		}
+
+		inline step_arena* arena() const noexcept
+		{
+			return _arena;
+		}
+
+		template <typename U>
+		bool operator==(const arena_allocator<U>& other) const noexcept
+		{
+			return _arena == other.arena();
+		}
+
+		template <typename U>
+		bool operator!=(const arena_allocator<U>& other) const noexcept
+		{
+			return _arena != other.arena();
+		}
+	};
+
+	//
+	// Scratch array of a step, gone with the next reset of its arena
+	//
+	template <typename T>
+	using arena_vector = std::vector<T, arena_allocator<T>>;
+}
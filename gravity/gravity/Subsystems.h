@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// Hierarchy of the bodies: the central body (the heaviest), and the subsystems around it - a planet with its
+	// moons. The primary of a body is the heavier body whose Hill sphere it is in, r < a * (m / 3 M)^(1/3) with a
+	// and M of that body's own primary, the smallest such sphere when there are more of them, and the central body
+	// when it is in none (the strongest pull would not do, the Sun pulls the Moon twice as hard as the Earth does).
+	// The subsystem of a body is where its chain of primaries ends, just before the central body. The central body
+	// and the bodies with nothing orbiting them are subsystems of their own
+	//
+	class subsystems
+	{
+		int _central{ -1 };
+
+		std::vector<int> _subsystem;
+		std::vector<int> _group;						// index into _groups, -1 for the single bodies
+		std::vector<std::vector<int>> _groups;			// the subsystems of more than one body, the primary first
+
+		// scratch of assign, kept so that the checks of the unchanged hierarchy do not allocate
+		std::vector<int> _order;
+		std::vector<double> _hill_r2;
+		std::vector<int> _primary;
+		std::vector<int> _assigned;
+
+	public:
+		inline int central() const noexcept
+		{
+			return _central;
+		}
+
+		inline int subsystem(int i) const noexcept
+		{
+			return _subsystem[i];
+		}
+
+		inline int group(int i) const noexcept
+		{
+			return _group[i];
+		}
+
+		inline const std::vector<std::vector<int>>& groups() const noexcept
+		{
+			return _groups;
+		}
+
+		//
+		// O(N^2), with no allocations unless the hierarchy changes. Returns whether it did, that is whether any body
+		// went to another subsystem
+		//
+		bool assign(int num_bodies, const double* x, const double* y, const double* z, const double* mass_G)
+		{
+			const int central{ static_cast<int>(std::max_element(mass_G, mass_G + num_bodies) - mass_G) };
+
+			// the heavier first, so the spheres of the candidate primaries of a body are known when it comes
+			_order.resize(num_bodies);
+			std::iota(_order.begin(), _order.end(), 0);
+			std::sort(_order.begin(), _order.end(), [&](int a, int b) { return mass_G[a] > mass_G[b]; });
+
+			_primary.assign(num_bodies, -1);
+			_hill_r2.assign(num_bodies, 0.0);
+			_hill_r2[central] = std::numeric_limits<double>::infinity();
+
+			auto distance2 = [&](int i, int j)
+			{
+				const double dx{ x[j] - x[i] };
+				const double dy{ y[j] - y[i] };
+				const double dz{ z[j] - z[i] };
+
+				return dx * dx + dy * dy + dz * dz;
+			};
+
+			for (const int i : _order)
+			{
+				if (i == central)
+					continue;
+
+				_primary[i] = central;
+
+				for (const int j : _order)
+				{
+					if (!(mass_G[j] > mass_G[i]))
+						break;
+
+					if (_hill_r2[j] < _hill_r2[_primary[i]] && distance2(i, j) < _hill_r2[j])
+					{
+						_primary[i] = j;
+					}
+				}
+
+				// the square of a * (m / 3 M)^(1/3) around its own primary
+				const int p{ _primary[i] };
+				_hill_r2[i] = distance2(i, p) * std::pow(mass_G[i] / (3.0 * mass_G[p]), 2.0 / 3.0);
+			}
+
+			// the primaries are heavier, so the chains end
+			_assigned.resize(num_bodies);
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				int s{ i };
+
+				while (_primary[s] >= 0 && _primary[s] != central)
+				{
+					s = _primary[s];
+				}
+
+				_assigned[i] = s;
+			}
+
+			if (central == _central && _assigned == _subsystem)
+				return false;
+
+			_central = central;
+			_subsystem.swap(_assigned);
+
+			_group.assign(num_bodies, -1);
+			_groups.clear();
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				const int s{ _subsystem[i] };
+
+				if (s == i)
+					continue;
+
+				if (_group[s] < 0)
+				{
+					_group[s] = static_cast<int>(_groups.size());
+					_groups.push_back({ s });
+				}
+
+				_group[i] = _group[s];
+				_groups[_group[s]].push_back(i);
+			}
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+
+namespace gravity
+{
+	//
+	// Massless test particles (asteroids, debris, spacecraft): they feel the massive bodies, but pull on nothing,
+	// so they cost O(N_massive) each instead of taking part in the pair loop. Only the dynamic state is kept, as a
+	// structure of arrays - no labels, no history generations.
+	//
+	// acc is the acceleration at the current location, kept from the end of the previous step
+	//
+	struct test_particles
+	{
+		hot_vector<double> x;
+		hot_vector<double> y;
+		hot_vector<double> z;
+
+		hot_vector<double> vx;
+		hot_vector<double> vy;
+		hot_vector<double> vz;
+
+		hot_vector<double> ax;
+		hot_vector<double> ay;
+		hot_vector<double> az;
+
+		bool acc_valid{ false };
+
+		std::vector<int> removal_remap;		// scratch of remove_at, kept so it does not allocate every time
+
+		inline size_t size() const noexcept
+		{
+			return x.size();
+		}
+
+		void resize(size_t n)
+		{
+			for (auto* v : { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az })
+			{
+				v->resize(n);
+			}
+
+			acc_valid = false;
+		}
+
+		void push_back(const vec3d_pd& location, const vec3d_pd& velocity)
+		{
+			x.push_back(location.x());
+			y.push_back(location.y());
+			z.push_back(location.z());
+			vx.push_back(velocity.x());
+			vy.push_back(velocity.y());
+			vz.push_back(velocity.z());
+			ax.push_back(0.0);
+			ay.push_back(0.0);
+			az.push_back(0.0);
+
+			acc_valid = false;
+		}
+
+		inline vec3d_pd location(size_t idx) const noexcept
+		{
+			return { x[idx], y[idx], z[idx] };
+		}
+
+		inline vec3d_pd velocity(size_t idx) const noexcept
+		{
+			return { vx[idx], vy[idx], vz[idx] };
+		}
+
+		//
+		// Drops the flagged particles, keeping the order of the rest
+		//
+		template <typename TFlags>
+		void remove_at(const TFlags& to_remove)
+		{
+			const size_t kept{ compaction_remap(to_remove, removal_remap) };
+
+			if (kept == size())
+				return;
+
+			for (auto* v : { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az })
+			{
+				compact(*v, removal_remap, kept);
+			}
+		}
+	};
+
+	//
+	// Pull of the massive bodies onto the particles [begin, end) into ax / ay / az, and whether each of them hit a
+	// body into hit. The particles are the inner loop, so it's element wise over the arrays and vectorises without
+	// any reductions
+	//
+	inline void test_particles_pull(
+		test_particles& particles,
+		int begin,
+		int end,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* mass_G,
+		const double* radius,
+		char* hit
+	) noexcept
+	{
+		double* const ax{ particles.ax.data() };
+		double* const ay{ particles.ay.data() };
+		double* const az{ particles.az.data() };
+
+		const double* const px{ particles.x.data() };
+		const double* const py{ particles.y.data() };
+		const double* const pz{ particles.z.data() };
+
+		for (int p = begin; p < end; ++p)
+		{
+			ax[p] = 0.0;
+			ay[p] = 0.0;
+			az[p] = 0.0;
+			hit[p] = 0;
+		}
+
+		for (int j = 0; j < num_bodies; ++j)
+		{
+			const double xj{ x[j] };
+			const double yj{ y[j] };
+			const double zj{ z[j] };
+			const double mj{ mass_G[j] };
+			const double rj2{ radius[j] * radius[j] };
+
+			for (int p = begin; p < end; ++p)
+			{
+				const double dx{ xj - px[p] };
+				const double dy{ yj - py[p] };
+				const double dz{ zj - pz[p] };
+
+				const double r2{ dx * dx + dy * dy + dz * dz };
+				const bool inside{ r2 <= rj2 };
+
+				// the particles inside a body are removed, their pull is of no interest
+				const double r2_live{ inside ? 1.0 : r2 };
+				const double s{ inside ? 0.0 : mj / (r2_live * std::sqrt(r2_live)) };
+
+				ax[p] += dx * s;
+				ay[p] += dy * s;
+				az[p] += dz * s;
+
+				hit[p] |= inside;
+			}
+		}
+	}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <immintrin.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace gravity
+{
+	//
+	// Blocks while *word == expected (or returns spuriously), and wakes all the threads blocked on the word
+	//
+	inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected) noexcept
+	{
+#if defined(_WIN32)
+		::WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+		::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+		(void)word;
+		(void)expected;
+		std::this_thread::yield();
+#endif
+	}
+
+	inline void futex_wake_all(std::atomic<uint32_t>& word) noexcept
+	{
+#if defined(_WIN32)
+		::WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+		::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+		(void)word;
+#endif
+	}
+
+	//
+	// Sense reversing barrier: the last thread to arrive flips the shared sense, which is what everybody else
+	// is waiting for. Waiters spin for a while first, as the other side is expected to be microseconds away,
+	// and only then go to sleep on the sense word
+	//
+	class spin_futex_barrier
+	{
+		static constexpr int SPIN_COUNT{ 4096 };
+
+		const int _count;
+
+		alignas(64) std::atomic<int> _arrived{ 0 };
+		alignas(64) std::atomic<uint32_t> _sense{ 0 };
+		std::atomic<int> _sleepers{ 0 };
+
+	public:
+		explicit spin_futex_barrier(int count)
+			: _count{ count }
+		{
+		}
+
+		//
+		// local_sense is owned by the calling thread, and flipped on every crossing
+		//
+		void arrive_and_wait(uint32_t& local_sense) noexcept
+		{
+			local_sense ^= 1;
+
+			if (_arrived.fetch_add(1, std::memory_order_acq_rel) == _count - 1)
+			{
+				_arrived.store(0, std::memory_order_relaxed);
+				_sense.store(local_sense, std::memory_order_seq_cst);
+
+				if (_sleepers.load(std::memory_order_seq_cst) > 0)
+				{
+					futex_wake_all(_sense);
+				}
+				return;
+			}
+
+			for (int spin = 0; spin < SPIN_COUNT; ++spin)
+			{
+				if (_sense.load(std::memory_order_acquire) == local_sense)
+					return;
+
+				_mm_pause();
+			}
+
+			_sleepers.fetch_add(1, std::memory_order_seq_cst);
+
+			while (_sense.load(std::memory_order_seq_cst) != local_sense)
+			{
+				futex_wait(_sense, local_sense ^ 1);
+			}
+
+			_sleepers.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	//
+	// Persistent team of threads for the small N stepping, where a step takes microseconds and a fork / join per
+	// step would cost more than the step itself.
+	//
+	// The threads stay alive (spinning, then sleeping) between the runs, the calling thread is member 0, and a run
+	// is just two barrier crossings - no allocations, no locks and no condition variables on the way
+	//
+	class thread_team
+	{
+		const int _size;
+
+		std::vector<std::thread> _threads;
+
+		spin_futex_barrier _start;
+		spin_futex_barrier _done;
+
+		uint32_t _caller_start_sense{ 0 };
+		uint32_t _caller_done_sense{ 0 };
+
+		// the current job, published by the start barrier
+		void* _job_context{ nullptr };
+		void (*_job_invoke)(void*, int, int) { nullptr };
+		bool _terminate{ false };
+
+	public:
+		explicit thread_team(int size)
+			: _size{ size }
+			, _start{ size }
+			, _done{ size }
+		{
+			for (int member = 1; member < size; ++member)
+			{
+				_threads.emplace_back(&thread_team::thread_main, this, member);
+			}
+		}
+
+		~thread_team()
+		{
+			_terminate = true;
+			_start.arrive_and_wait(_caller_start_sense);
+
+			for (auto& thread : _threads)
+			{
+				thread.join();
+			}
+		}
+
+		thread_team(const thread_team&) = delete;
+		thread_team& operator=(const thread_team&) = delete;
+
+		inline int size() const noexcept
+		{
+			return _size;
+		}
+
+		//
+		// Calls func(member, size) on every member of the team, and returns once all of them are done
+		//
+		template <typename TFunc>
+		void run(TFunc& func) noexcept
+		{
+			using func_type = std::remove_reference_t<TFunc>;
+
+			if (_size == 1)
+			{
+				func(0, 1);
+				return;
+			}
+
+			_job_context = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+			_job_invoke = [](void* context, int member, int size)
+			{
+				(*static_cast<func_type*>(context))(member, size);
+			};
+
+			_start.arrive_and_wait(_caller_start_sense);
+
+			func(0, size());
+
+			_done.arrive_and_wait(_caller_done_sense);
+		}
+
+	private:
+		void thread_main(int member) noexcept
+		{
+			uint32_t start_sense{ 0 };
+			uint32_t done_sense{ 0 };
+
+			while (true)
+			{
+				_start.arrive_and_wait(start_sense);
+
+				if (_terminate)
+					return;
+
+				_job_invoke(_job_context, member, size());
+
+				_done.arrive_and_wait(done_sense);
+			}
+		}
+	};
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vec3d.h"
+#include "BodyStorage.h"
+
+namespace gravity
+{
+	//
+	// Shape of the tiles of the cache blocked force kernel: a block of i_block target bodies is swept over the
+	// source bodies j_tile at a time, so the source tile stays in L1 while it is reused by every target of the block
+	//
+	struct tile_shape
+	{
+		static constexpr int MAX_I_BLOCK{ 128 };
+
+		int i_block{ 32 };
+		int j_tile{ 256 };
+
+		bool valid() const noexcept
+		{
+			return i_block > 0 && i_block <= MAX_I_BLOCK && j_tile > 0;
+		}
+	};
+
+	//
+	// Pull of all the bodies onto the bodies [i_begin, i_end), with i_end - i_begin <= tile_shape::MAX_I_BLOCK.
+	// acc receives the accelerations of the block, on_tidal_heating(i) is called as in the other kernels. The colliding
+	// pairs are masked out of the sum with no branches, they are left to the broad phase (see broad_phase)
+	//
+	template <typename TOnTidalHeating>
+	inline void tiled_block_pull(
+		int i_begin,
+		int i_end,
+		int j_tile,
+		int num_bodies,
+		const double* x,
+		const double* y,
+		const double* z,
+		const double* mass_G,
+		const double* radius,
+		vec3d_pd* acc,
+		TOnTidalHeating&& on_tidal_heating
+	) noexcept
+	{
+		const int block_size{ i_end - i_begin };
+
+		std::array<double, tile_shape::MAX_I_BLOCK> ax{};
+		std::array<double, tile_shape::MAX_I_BLOCK> ay{};
+		std::array<double, tile_shape::MAX_I_BLOCK> az{};
+		std::array<bool, tile_shape::MAX_I_BLOCK> heat{};
+
+		for (int j_begin = 0; j_begin < num_bodies; j_begin += j_tile)
+		{
+			const int j_end{ std::min(j_begin + j_tile, num_bodies) };
+
+			for (int bi = 0; bi < block_size; ++bi)
+			{
+				const int i{ i_begin + bi };
+
+				const double xi{ x[i] };
+				const double yi{ y[i] };
+				const double zi{ z[i] };
+				const double ri{ radius[i] };
+				const double tidal_r{ ri * 10.0 };
+
+				double sx{ 0.0 };
+				double sy{ 0.0 };
+				double sz{ 0.0 };
+
+				for (int j = j_begin; j < j_end; ++j)
+				{
+					if (j == i)
+						continue;
+
+					const double dx{ x[j] - xi };
+					const double dy{ y[j] - yi };
+					const double dz{ z[j] - zi };
+
+					const double r2{ dx * dx + dy * dy + dz * dz };
+					const double r{ std::sqrt(r2) };
+
+					const bool live{ r > ri + radius[j] };
+					const double s{ live ? mass_G[j] / (r2 * r) : 0.0 };
+
+					sx += dx * s;
+					sy += dy * s;
+					sz += dz * s;
+
+					heat[bi] |= live & (r < tidal_r);
+				}
+
+				ax[bi] += sx;
+				ay[bi] += sy;
+				az[bi] += sz;
+			}
+		}
+
+		for (int bi = 0; bi < block_size; ++bi)
+		{
+			acc[bi] = { ax[bi], ay[bi], az[bi] };
+
+			if (heat[bi])
+			{
+				on_tidal_heating(i_begin + bi);
+			}
+		}
+	}
+
+	//
+	// Picks the tile shape by timing the candidates on a synthetic cluster, and caches the winner in a small
+	// text file, so it only runs once per machine (and per build flavour, as the AVX / AVX2 / AVX-512 builds have
+	// different optima)
+	//
+	class tile_autotuner
+	{
+		static constexpr int BENCHMARK_BODIES{ 4096 };
+		static constexpr int BENCHMARK_TARGETS{ 512 };
+		static constexpr int BENCHMARK_REPEATS{ 3 };
+
+		static constexpr std::array<int, 4> I_BLOCK_CANDIDATES{ 8, 16, 32, 64 };
+		static constexpr std::array<int, 6> J_TILE_CANDIDATES{ 64, 128, 256, 512, 1024, 2048 };
+
+	public:
+		static const char* build_flavour() noexcept
+		{
+#if defined(AVX512)
+			return "avx512";
+#elif defined(AVX2)
+			return "avx2";
+#elif defined(AVX)
+			return "avx";
+#else
+			return "sse";
+#endif
+		}
+
+		static std::string default_cache_file()
+		{
+			std::error_code ec;
+			auto dir{ std::filesystem::temp_directory_path(ec) };
+
+			if (ec)
+				return "gravity_tiles.cfg";
+
+			return (dir / "gravity_tiles.cfg").string();
+		}
+
+		//
+		// Reads the cached shape, returns false when the file is missing, malformed, or was written by another build
+		//
+		static bool load(const std::string& cache_file, tile_shape& shape)
+		{
+			std::ifstream istrm(cache_file);
+
+			std::string flavour;
+			tile_shape loaded{};
+
+			if (!(istrm >> flavour >> loaded.i_block >> loaded.j_tile))
+				return false;
+
+			if (flavour != build_flavour() || !loaded.valid())
+				return false;
+
+			shape = loaded;
+			return true;
+		}
+
+		static void save(const std::string& cache_file, const tile_shape& shape)
+		{
+			std::ofstream ostrm(cache_file, std::ios::trunc);
+			ostrm << build_flavour() << " " << shape.i_block << " " << shape.j_tile << std::endl;
+		}
+
+		static tile_shape tune()
+		{
+			body_generation generation;
+			body_properties props;
+
+			std::mt19937 generator{ 1 };
+			std::uniform_real_distribution<double> distribution{ -1.0e12, 1.0e12 };
+
+			generation.resize(BENCHMARK_BODIES);
+			props.resize(BENCHMARK_BODIES);
+
+			for (int i = 0; i < BENCHMARK_BODIES; ++i)
+			{
+				generation.x[i] = distribution(generator);
+				generation.y[i] = distribution(generator);
+				generation.z[i] = distribution(generator);
+				props.mass_G[i] = 1.0e10;
+				props.radius[i] = 1.0;
+			}
+
+			std::vector<vec3d_pd> acc(tile_shape::MAX_I_BLOCK);
+
+			tile_shape best{};
+			double best_time{ std::numeric_limits<double>::max() };
+
+			for (auto i_block : I_BLOCK_CANDIDATES)
+			{
+				for (auto j_tile : J_TILE_CANDIDATES)
+				{
+					double time{ std::numeric_limits<double>::max() };
+
+					for (int repeat = 0; repeat < BENCHMARK_REPEATS; ++repeat)
+					{
+						const auto start{ std::chrono::steady_clock::now() };
+
+						for (int i_begin = 0; i_begin < BENCHMARK_TARGETS; i_begin += i_block)
+						{
+							tiled_block_pull(
+								i_begin,
+								std::min(i_begin + i_block, BENCHMARK_TARGETS),
+								j_tile,
+								BENCHMARK_BODIES,
+								generation.x.data(),
+								generation.y.data(),
+								generation.z.data(),
+								props.mass_G.data(),
+								props.radius.data(),
+								acc.data(),
+								[](int) {});
+						}
+
+						time = std::min(time, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+					}
+
+					if (time < best_time)
+					{
+						best_time = time;
+						best = { i_block, j_tile };
+					}
+				}
+			}
+
+			return best;
+		}
+
+		static tile_shape load_or_tune(const std::string& cache_file)
+		{
+			tile_shape shape{};
+
+			if (!load(cache_file, shape))
+			{
+				shape = tune();
+				save(cache_file, shape);
+			}
+
+			return shape;
+		}
+	};
+}
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gravity
+{
+	//
+	// Portable replacement of concurrency::parallel_for.
+	//
+	// The calling thread is worker 0 and works along with the pool threads. Every parallel_for splits its range
+	// into one contiguous chunk per worker, each worker then keeps splitting its chunk in halves (pushing the upper
+	// half back onto its own deque) until the piece is down to the grain size. Workers take the smallest pieces
+	// from the back of their own deque, and when it runs dry they steal the largest piece from the front of
+	// someone else's.
+	//
+	// Nested calls (from within a parallel_for body) run sequentially on the calling worker.
+	//
+	class work_stealing_pool
+	{
+		struct range
+		{
+			int begin{};
+			int end{};
+		};
+
+		//
+		// Double-ended queue of the ranges on a ring that only ever grows, unlike std::deque which allocates and frees
+		// its blocks as it goes, so the parallel_for calls of the steady state do not touch the heap
+		//
+		struct range_ring
+		{
+			std::vector<range> slots;
+			size_t head{ 0 };
+			size_t count{ 0 };
+
+			inline bool empty() const noexcept
+			{
+				return count == 0;
+			}
+
+			void push_back(const range& r)
+			{
+				if (count == slots.size())
+				{
+					std::vector<range> larger(std::max<size_t>(16, slots.size() * 2));
+					for (size_t k = 0; k < count; ++k)
+					{
+						larger[k] = slots[(head + k) % slots.size()];
+					}
+
+					slots.swap(larger);
+					head = 0;
+				}
+
+				slots[(head + count) % slots.size()] = r;
+				count++;
+			}
+
+			range pop_back() noexcept
+			{
+				count--;
+				return slots[(head + count) % slots.size()];
+			}
+
+			range pop_front() noexcept
+			{
+				const range r{ slots[head] };
+				head = (head + 1) % slots.size();
+				count--;
+				return r;
+			}
+		};
+
+		struct alignas(64) worker_queue
+		{
+			std::mutex lock;
+			range_ring ranges;
+		};
+
+		// chunks per worker that the default grain size aims for, so there is something left to steal
+		static constexpr int DEFAULT_CHUNKS_PER_WORKER{ 8 };
+
+		std::vector<std::thread> _threads;
+		std::vector<std::unique_ptr<worker_queue>> _queues;
+
+		std::mutex _job_mutex;
+		std::condition_variable _job_available;
+		uint64_t _job_generation{ 0 };
+		bool _terminate{ false };
+
+		// the current job, published under _job_mutex
+		void* _job_context{ nullptr };
+		void (*_job_invoke)(void*, int, int) { nullptr };
+		int _job_grain{ 1 };
+		bool _job_pinned{ false };					// no stealing, see on_each_worker
+
+		std::atomic<int> _remaining{ 0 };			// iterations not yet executed
+		std::atomic<int> _busy_workers{ 0 };		// pool threads that may still touch the job
+
+		struct worker_identity
+		{
+			const work_stealing_pool* pool{ nullptr };
+			int index{ 0 };
+		};
+
+	public:
+		explicit work_stealing_pool(int num_threads = default_num_threads())
+		{
+			start(num_threads);
+		}
+
+		~work_stealing_pool()
+		{
+			stop();
+		}
+
+		work_stealing_pool(const work_stealing_pool&) = delete;
+		work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+		static int default_num_threads() noexcept
+		{
+			return static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		}
+
+		inline int num_threads() const noexcept
+		{
+			return static_cast<int>(_queues.size());
+		}
+
+		//
+		// Index of the calling thread among the workers of this pool, in [0, num_threads()). The threads outside of
+		// the pool get 0, as the thread that owns the pool is worker 0 of its parallel_for calls
+		//
+		inline int worker_index() const noexcept
+		{
+			const auto& current{ current_worker() };
+			return current.pool == this ? current.index : 0;
+		}
+
+		//
+		// Number of threads, including the calling one. Must not be called while a parallel_for is running
+		//
+		void resize(int num_threads)
+		{
+			num_threads = std::max(1, num_threads);
+
+			if (num_threads == this->num_threads())
+				return;
+
+			stop();
+			start(num_threads);
+		}
+
+		template <typename TFunc>
+		void parallel_for(int begin, int end, TFunc&& func)
+		{
+			const int count{ end - begin };
+			parallel_for(begin, end, std::max(1, count / (num_threads() * DEFAULT_CHUNKS_PER_WORKER)), std::forward<TFunc>(func));
+		}
+
+		//
+		// Calls func(i) for every i in [begin, end), pieces of at most grain iterations are never split further
+		//
+		template <typename TFunc>
+		void parallel_for(int begin, int end, int grain, TFunc&& func)
+		{
+			const int count{ end - begin };
+			if (count <= 0)
+				return;
+
+			if (num_threads() == 1 || count <= grain || inside_worker())
+			{
+				for (int i = begin; i < end; ++i)
+				{
+					func(i);
+				}
+				return;
+			}
+
+			const int workers{ num_threads() };
+
+			for (int w = 0; w < workers; ++w)
+			{
+				const int chunk_begin{ begin + static_cast<int>(static_cast<int64_t>(count) * w / workers) };
+				const int chunk_end{ begin + static_cast<int>(static_cast<int64_t>(count) * (w + 1) / workers) };
+
+				if (chunk_begin < chunk_end)
+				{
+					_queues[w]->ranges.push_back({ chunk_begin, chunk_end });
+				}
+			}
+
+			run(func, count, grain, false);
+		}
+
+		//
+		// Calls func(worker) once for every worker in [0, num_threads()), each on the worker's own thread - for what
+		// must happen on a given thread, like the first touch of the memory that thread is going to work on
+		//
+		template <typename TFunc>
+		void on_each_worker(TFunc&& func)
+		{
+			const int workers{ num_threads() };
+
+			if (workers == 1 || inside_worker())
+			{
+				for (int w = 0; w < workers; ++w)
+				{
+					func(w);
+				}
+				return;
+			}
+
+			for (int w = 0; w < workers; ++w)
+			{
+				_queues[w]->ranges.push_back({ w, w + 1 });
+			}
+
+			run(func, workers, 1, true);
+		}
+
+	private:
+		//
+		// Runs the ranges queued up for the workers, count iterations in all
+		//
+		template <typename TFunc>
+		void run(TFunc& func, int count, int grain, bool pinned)
+		{
+			using func_type = std::remove_reference_t<TFunc>;
+
+			_remaining.store(count, std::memory_order_relaxed);
+			_busy_workers.store(num_threads() - 1, std::memory_order_relaxed);
+
+			{
+				std::lock_guard l{ _job_mutex };
+
+				_job_context = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+				_job_invoke = [](void* context, int range_begin, int range_end)
+				{
+					auto& f{ *static_cast<func_type*>(context) };
+					for (int i = range_begin; i < range_end; ++i)
+					{
+						f(i);
+					}
+				};
+				_job_grain = std::max(1, grain);
+				_job_pinned = pinned;
+				_job_generation++;
+			}
+			_job_available.notify_all();
+
+			run_job(0);
+
+			// the pool threads may still be on their way out of run_job, and must not see the next job's ranges
+			while (_busy_workers.load(std::memory_order_acquire) != 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		static bool& inside_worker() noexcept
+		{
+			static thread_local bool inside{ false };
+			return inside;
+		}
+
+		static worker_identity& current_worker() noexcept
+		{
+			static thread_local worker_identity current;
+			return current;
+		}
+
+		void start(int num_threads)
+		{
+			num_threads = std::max(1, num_threads);
+
+			_terminate = false;
+
+			_queues.clear();
+			for (int w = 0; w < num_threads; ++w)
+			{
+				_queues.push_back(std::make_unique<worker_queue>());
+			}
+
+			for (int w = 1; w < num_threads; ++w)
+			{
+				_threads.emplace_back(&work_stealing_pool::thread_main, this, w, _job_generation);
+			}
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard l{ _job_mutex };
+				_terminate = true;
+			}
+			_job_available.notify_all();
+
+			for (auto& thread : _threads)
+			{
+				if (thread.joinable())
+					thread.join();
+			}
+
+			_threads.clear();
+		}
+
+		void thread_main(int worker, uint64_t seen_generation)
+		{
+			while (true)
+			{
+				{
+					std::unique_lock l{ _job_mutex };
+					_job_available.wait(l, [&] { return _terminate || _job_generation != seen_generation; });
+
+					if (_terminate)
+						return;
+
+					seen_generation = _job_generation;
+				}
+
+				run_job(worker);
+
+				_busy_workers.fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		bool pop_local(int worker, range& r)
+		{
+			auto& queue{ *_queues[worker] };
+			std::lock_guard l{ queue.lock };
+
+			if (queue.ranges.empty())
+				return false;
+
+			r = queue.ranges.pop_back();
+			return true;
+		}
+
+		bool steal(int worker, range& r)
+		{
+			const int workers{ num_threads() };
+
+			for (int offset = 1; offset < workers; ++offset)
+			{
+				auto& queue{ *_queues[(worker + offset) % workers] };
+				std::lock_guard l{ queue.lock };
+
+				if (!queue.ranges.empty())
+				{
+					r = queue.ranges.pop_front();
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void run_job(int worker)
+		{
+			inside_worker() = true;
+
+			// the caller may be a worker of another pool
+			const worker_identity outer{ current_worker() };
+			current_worker() = { this, worker };
+
+			auto& queue{ *_queues[worker] };
+
+			while (_remaining.load(std::memory_order_acquire) > 0)
+			{
+				range r;
+
+				if (!pop_local(worker, r) && (_job_pinned || !steal(worker, r)))
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				while (r.end - r.begin > _job_grain)
+				{
+					const int middle{ r.begin + (r.end - r.begin) / 2 };
+					{
+						std::lock_guard l{ queue.lock };
+						queue.ranges.push_back({ middle, r.end });
+					}
+					r.end = middle;
+				}
+
+				_job_invoke(_job_context, r.begin, r.end);
+
+				_remaining.fetch_sub(r.end - r.begin, std::memory_order_acq_rel);
+			}
+
+			current_worker() = outer;
+			inside_worker() = false;
+		}
+	};
+}
@@ -60,7 +60,6 @@
 
 #include "vec3d.h"
 #include "Random.h"
-#include "ThreadGrid.h"
 
 #include "Utils.h"
 
@@ -77,6 +76,10 @@ namespace gravity
 		gravity_struct<method> _objects;
         Random _random{};
 
+		// the bodies as of _snapshot_iteration, see get_objects
+		mutable std::vector<mass_body> _snapshot;
+		mutable int64_t _snapshot_iteration{ -1 };
+
 	public:
         World()
         {	
@@ -261,11 +264,36 @@ X =-1.033890980382836E+08 Y =-2.022621998544986E+08 Z =-1.702828498137295E+06
  */
 		}
 
-        const std::vector<mass_body>& get_objects() const noexcept
+		//
+		// The view draws every frame, while the bodies only change with the steps, so they are gathered from the
+		// storage once per step (or load) into an array that is kept for the frames in between
+		//
+        const std::vector<mass_body>& get_objects() const
         {
-            return _objects.get_bodies();
+			if (_snapshot_iteration != _objects.current_iteration() || _snapshot.size() != _objects.num_bodies())
+			{
+				_objects.get_bodies(_snapshot);
+				_snapshot_iteration = _objects.current_iteration();
+			}
+
+            return _snapshot;
         }
 
+		std::vector<int> take_body_remap() noexcept
+		{
+			return _objects.take_body_remap();
+		}
+
+		size_t num_test_particles() const noexcept
+		{
+			return _objects.num_test_particles();
+		}
+
+		mass_body get_test_particle(int idx) const
+		{
+			return _objects.get_test_particle(idx);
+		}
+
 		void save_to(std::ostream& stream)
 		{
 			_objects.save_to(stream);
@@ -274,6 +302,7 @@ X =-1.033890980382836E+08 Y =-2.022621998544986E+08 Z =-1.702828498137295E+06
 		void load_from(std::istream& stream)
 		{
 			_objects.load_from(stream);
+			_snapshot_iteration = -1;
 		}
 	
 	public:
@@ -287,6 +316,16 @@ X =-1.033890980382836E+08 Y =-2.022621998544986E+08 Z =-1.702828498137295E+06
 			return _objects.current_iteration();
 		}
 
+		uint64_t step_allocations() const noexcept
+		{
+			return _objects.step_allocations();
+		}
+
+		double simulation_time() const noexcept
+		{
+			return _objects.simulation_time();
+		}
+
 		uint64_t current_time_epoch_millis() const noexcept
 		{
 			return _objects.current_time_epoch_millis();
@@ -302,8 +341,60 @@ X =-1.033890980382836E+08 Y =-2.022621998544986E+08 Z =-1.702828498137295E+06
 			_objects.set_time_delta(time_delta);
 		}
 
+		void set_tolerance(double tolerance)
+		{
+			_objects.set_tolerance(tolerance);
+		}
+
+		void set_force_split(int substeps, double cutoff)
+		{
+			_objects.set_force_split(substeps, cutoff);
+		}
+
+		void set_collision_interval(int steps)
+		{
+			_objects.set_collision_interval(steps);
+		}
+
+		void set_num_worker_threads(int num_threads)
+		{
+			_objects.set_num_worker_threads(num_threads);
+		}
+
+		void set_force_kernel(force_kernel kernel)
+		{
+			_objects.set_force_kernel(kernel);
+		}
+
+		void set_tile_shape(const tile_shape& shape)
+		{
+			_objects.set_tile_shape(shape);
+		}
+
+		void set_force_engine(force_engine engine)
+		{
+			_objects.set_force_engine(engine);
+		}
+
+		void set_tree_opening_angle(double theta)
+		{
+			_objects.set_tree_opening_angle(theta);
+		}
+
+		void set_fmm_order(int order)
+		{
+			_objects.set_fmm_order(order);
+		}
+
+		void set_tree_quadrupole(bool quadrupole)
+		{
+			_objects.set_tree_quadrupole(quadrupole);
+		}
+
 		bool load_from_csv(std::string input_file)
 		{
+			_snapshot_iteration = -1;
+
 			if (!input_file.empty())
 				return _objects.load_from_csv(input_file);
 			else
@@ -8,21 +8,41 @@
 #include <sstream>
 #include <array>
 #include <iostream>
+#include <thread>
 
-#include <list>
-#include <unordered_set>
-
-#include <ppl.h>
+#include <memory>
+#include <cstring>
 
+#ifdef _MSC_VER
 #include <intrin.h>
 #pragma intrinsic(__rdtsc)
+#else
+#include <x86intrin.h>
+#endif
 
 #include "vec3d.h"
 #include "kahan.h"
 
 #include "WorldConsts.h"
-
-#include "ThreadGrid.h"
+#include "BodyStorage.h"
+#include "Integrators.h"
+#include "KeplerDrift.h"
+#include "BlockSteps.h"
+#include "ForceSplitting.h"
+#include "Subsystems.h"
+#include "TestParticles.h"
+#include "KsRegularization.h"
+#include "BroadPhase.h"
+#include "Contacts.h"
+#include "StepArena.h"
+#include "AllocationCounter.h"
+#include "SimdForceKernel.h"
+#include "TiledForceKernel.h"
+#include "BarnesHut.h"
+#include "FastMultipole.h"
+#include "WorkStealingPool.h"
+
+#include "ThreadTeam.h"
 
 
 
@@ -183,14 +203,18 @@ namespace gravity
 		}
 	};
 
-	enum class integration_method
+	enum class force_kernel
+	{
+		scalar,
+		simd,	// packed AVX2 / AVX-512 kernel, only available in the builds that define AVX2 or AVX512
+		tiled,	// cache blocked kernel, see TiledForceKernel.h
+	};
+
+	enum class force_engine
 	{
-		linear,
-		linear_kahan,
-		quadratic,
-		quadratic_kahan,
-		cubic,
-		cubic_kahan,
+		direct,		// exact O(N^2) pair loop
+		barnes_hut,	// O(N log N) octree, see BarnesHut.h
+		fmm,		// O(N) fast multipole method, see FastMultipole.h
 	};
 
 	//
@@ -200,24 +224,27 @@ namespace gravity
 	class gravity_struct
 	{
 	public:
-		using mass_bodies = std::vector<mass_body>;
+		using mass_bodies = body_generation;
+
+		static constexpr int NUM_GENERATIONS{ generations_count(method) };
 
-		static constexpr int NUM_GENERATIONS{ 4 };
+		// the generations of the on-disk format, whatever the ring holds
+		static constexpr int SAVED_GENERATIONS{ 4 };
 
 	private:
-		// 4 generations: 
+		// up to 4 generations: 
 		// T+1 - next
 		// T+0 - current
-		// T-1
-		// T-2 
+		// T-1 - only with history_depth >= 1, or as the scratch of the kick-drift methods
+		// T-2 - only with history_depth >= 2, or as the scratch of the kick-drift methods
 		//
-		// current generation index is (_current_iteration % 4), and the other generations are moving accordingly
+		// current generation index is (_current_iteration % NUM_GENERATIONS), and the other generations are moving
+		// accordingly. When the ring is shorter the generations it lacks alias the later ones, which the methods
+		// that do not have them never read
 		//
 
 		std::array<mass_bodies, NUM_GENERATIONS> _bodies_gens;
-
-		std::list<std::unordered_set<int>> _collisions;
-		std::mutex _collisions_mutex;
+		body_properties _props;
 
 		uint64_t _report_every_n_iterations{ 0 };
 		uint64_t _max_iterations{ 0 };
@@ -231,6 +258,109 @@ namespace gravity
 		static constexpr uint64_t PERFORMANCE_PROFILING_CYCLE{ 8192 };
 		static constexpr uint32_t PERFORMANCE_PROFILING_N{ 8 };
 
+		// block decomposition of iterate_gravity_forces_symmetric_mt
+		static constexpr int SYMMETRIC_BLOCKS_PER_THREAD{ 4 };
+		static constexpr int SYMMETRIC_MIN_BLOCK_SIZE{ 16 };
+
+		force_kernel _force_kernel{ force_kernel::scalar };
+		force_engine _force_engine{ force_engine::direct };
+
+		tile_shape _tile_shape{};
+
+		// symplectic stepping, see iterate_composition / iterate_wisdom_holman
+		double _stage_kick{ 0.0 };
+		double _stage_drift{ 0.0 };
+		int _central_body{ -1 };		// held out of the kicks, wisdom_holman only
+		size_t _symplectic_acc_size{ 0 };	// number of the bodies the kept accelerations are for
+
+		// adaptive stepping, see iterate_bulirsch_stoer
+		static constexpr int BS_MAX_COLUMNS{ 8 };		// up to 16 substeps
+		static constexpr double BS_SAFETY{ 0.9 };
+		static constexpr double BS_MIN_FACTOR{ 0.2 };
+		static constexpr double BS_MAX_FACTOR{ 4.0 };
+		static constexpr double BS_MIN_STEP_FRACTION{ 1e-9 };	// of time_delta, accepted whatever the error
+
+		double _tolerance{ 1e-12 };
+		double _adaptive_step{ 0.0 };		// the next step to try
+		double _simulation_time{ 0.0 };		// seconds since the start, the adaptive methods only
+		double _next_report_time{ 0.0 };
+
+		std::array<std::vector<double>, BS_MAX_COLUMNS> _bs_columns;
+		std::vector<double> _bs_body_error;
+
+		// individual steps, see iterate_block_steps
+		static constexpr double BLOCK_ETA{ 0.01 };		// of the time scale of the nearest encounter
+		static constexpr double HERMITE_ETA{ 0.02 };		// Aarseth criterion
+		static constexpr double HERMITE_ETA_START{ 0.01 };	// of acceleration / jerk, for the first step
+
+		block_steps _block;
+		std::vector<int> _block_active;
+
+		// multiple time stepping, see iterate_respa
+		force_split _split;
+		std::vector<vec3d_pd> _split_near;
+		std::vector<vec3d_pd> _split_far;
+
+		// hierarchical stepping, see iterate_hierarchical
+		static constexpr double HIERARCHY_ETA{ 0.0025 };			// of the shortest orbit within a subsystem / 2 pi
+		static constexpr int HIERARCHY_MAX_SUBSTEPS{ 1 << 16 };
+
+		subsystems _subsystems;
+		std::vector<vec3d_pd> _external_acc;
+		std::vector<vec3d_pd> _internal_acc;
+		std::vector<vec3d_pd> _group_barycentres;
+		std::vector<double> _group_mass_G;
+
+		// regularised pairs, see iterate_ks_regularized
+		static constexpr double KS_RESOLUTION{ 50.0 };			// time_delta resolves two body time scales above this many steps
+		static constexpr double KS_MAX_PERTURBATION{ 0.25 };	// of the pull within the pair
+
+		std::vector<std::pair<int, int>> _ks_pairs;
+		std::vector<int> _ks_partner;			// -1 for the bodies on their own
+		std::vector<vec3d_pd> _ks_total;		// pull of all the bodies
+		std::vector<int> _ks_candidate;			// the body of the shortest two body time scale
+
+		// collision detection, see iterate_broad_phase
+		broad_phase _broad_phase;
+		int _collision_interval{ 1 };		// steps
+		int _steps_since_collision_check{ 0 };
+		std::vector<double> _collision_start_x;
+		std::vector<double> _collision_start_y;
+		std::vector<double> _collision_start_z;
+
+		// massless bodies, see iterate_test_particles
+		static constexpr int TEST_PARTICLES_BLOCK{ 256 };
+
+		test_particles _particles;
+		std::vector<char> _particles_hit;
+
+		work_stealing_pool _pool;
+		int _num_worker_threads{ work_stealing_pool::default_num_threads() };
+
+		// where the bodies went on the merges and escapes since the last take_body_remap
+		std::vector<int> _body_remap;
+
+		// the colliding pairs of the step, see iterate_collision_merges
+		contact_buffers _contacts{ _pool.num_threads() };
+
+		// scratch memory of the step, per worker, reset at the start of every step
+		step_arenas _arenas{ _pool.num_threads() };
+
+		// heap allocations of the last step, before its report (see allocation_counter)
+		uint64_t _step_allocations{ 0 };
+
+		// bodies when the arrays were last placed on the workers, see place_body_arrays
+		size_t _placed_bodies{ 0 };
+
+		// small N stepping, see iterate_gravity_forces_team
+		static constexpr int TEAM_MAX_BODIES{ 512 };
+		static constexpr int TEAM_MIN_BODIES_PER_THREAD{ 4 };
+
+		std::unique_ptr<thread_team> _team;
+
+		barnes_hut_tree _tree;
+		fmm_solver _fmm{ _pool };
+
 		double _time_delta{ 0.1 };
 		double _time_delta_times_1_2{ _time_delta / 2.0 };
 		double _time_delta_times_1_12{ _time_delta / 12.0 };
@@ -253,31 +383,88 @@ namespace gravity
 			return _bodies_gens[(_current_iteration + NUM_GENERATIONS + gen) % NUM_GENERATIONS];
 		}
 
-		[[noreturn]] void on_bodies_vector_mismatch() noexcept 
+		//
+		// Generation (relative to the current one, from -2 to 1) that the slot of the saved 4-ring holds
+		//
+		int saved_generation_offset(int slot) const noexcept
 		{
-			std::cerr << "Internal error: inconsistency in size of _bodies_gens vectors" << std::endl;
-			std::terminate();
+			const int offset{ static_cast<int>((slot + SAVED_GENERATIONS - _current_iteration % SAVED_GENERATIONS) % SAVED_GENERATIONS) };
+			return offset >= 2 ? offset - SAVED_GENERATIONS : offset;
 		}
 
-		void register_collisions(int i, int j)
+		//
+		// Moves the array to memory first touched by the workers, each on the slice parallel_for gives it first, so
+		// with first touch NUMA placement the pages are on the node of the thread that works on them
+		//
+		template <typename TVector>
+		void place_on_workers(TVector& v)
+		{
+			if (v.empty())
+				return;
+
+			TVector placed{ v.get_allocator() };
+			placed.reserve(v.size());
+
+			// the bytes of the storage the elements are about to be copied into
+			const auto bytes{ reinterpret_cast<unsigned char*>(placed.data()) };
+			const size_t num_bytes{ v.size() * sizeof(typename TVector::value_type) };
+			const size_t workers{ static_cast<size_t>(_pool.num_threads()) };
+
+			_pool.on_each_worker(
+				[&](int w)
+				{
+					const size_t begin{ num_bytes * w / workers };
+					const size_t end{ num_bytes * (w + 1) / workers };
+
+					std::memset(bytes + begin, 0, end - begin);
+				});
+
+			placed.assign(v.begin(), v.end());
+			v.swap(placed);
+		}
+
+		//
+		// With body_memory::first_touch, places the arrays of the bodies that the steps go through whenever there are
+		// new bodies. The merges and the escapes only compact the arrays, so the pages stay where they are
+		//
+		void place_body_arrays()
 		{
-			std::lock_guard l{ _collisions_mutex };
+			const size_t num_bodies{ _props.size() };
 
-			bool found = false;
-			for (auto& c : _collisions)
+			if (body_memory::first_touch() && num_bodies > _placed_bodies)
 			{
-				if (c.count(i) > 0 || c.count(j) > 0)
+				for (auto& gen : _bodies_gens)
 				{
-					found = true;
-					c.insert(i);
-					c.insert(j);
+					gen.for_each_array([this](auto& v) { place_on_workers(v); });
 				}
-			}
 
-			if (!found)
-			{
-				_collisions.push_back(std::unordered_set{ i, j });
+				place_on_workers(_props.mass_G);
+				place_on_workers(_props.radius);
 			}
+
+			_placed_bodies = num_bodies;
+		}
+
+		//
+		// Scratch memory of the calling worker for the rest of the step
+		//
+		inline step_arena& scratch() noexcept
+		{
+			return _arenas[_pool.worker_index()];
+		}
+
+		[[noreturn]] void on_bodies_vector_mismatch() noexcept 
+		{
+			std::cerr << "Internal error: inconsistency in size of _bodies_gens vectors" << std::endl;
+			std::terminate();
+		}
+
+		//
+		// Called from within the parallel passes, into the buffer of the calling worker with no locks
+		//
+		void register_collisions(int i, int j)
+		{
+			_contacts.add(_pool.worker_index(), i, j);
 		}
 
 
@@ -290,105 +477,201 @@ namespace gravity
 					on_bodies_vector_mismatch();
 				}
 			}
+
+			if (this->_bodies_gens[0].size() != this->_props.size())
+			{
+				on_bodies_vector_mismatch();
+			}
 		}
 
-		void remove_at(int idx)
+		//
+		// Drops the flagged bodies from all the generations and the properties in a single stable pass. Returns
+		// where the bodies went (see compaction_remap), or nothing when none was flagged
+		//
+		template <typename TFlags>
+		arena_vector<int> remove_at(const TFlags& indexes)
 		{
+			arena_vector<int> remap{ arena_allocator<int>{ scratch() } };
+			const size_t kept{ compaction_remap(indexes, remap) };
+
+			if (kept == _props.size())
+			{
+				remap.clear();
+				return remap;
+			}
+
 			for (auto& generation : _bodies_gens)
 			{
-				generation.erase(generation.begin() + idx);
+				generation.compact(remap, kept);
 			}
+			_props.compact(remap, kept);
+
+			return remap;
 		}
 
-		void remove_at(std::vector<bool>& indexes)
+		//
+		// Adds a removal to the remap since the last take_body_remap
+		//
+		void record_body_remap(const arena_vector<int>& remap)
 		{
-			for (int idx = static_cast<int>(_bodies_gens[0].size()) - 1; idx >= 0; --idx)
+			if (_body_remap.empty())
+			{
+				_body_remap.assign(remap.begin(), remap.end());
+				return;
+			}
+
+			for (auto& idx : _body_remap)
 			{
-				if (indexes[idx])
+				if (idx >= 0)
 				{
-					remove_at(idx);
+					idx = remap[idx];
 				}
 			}
 		}
 
-		void iterate_collision_merges() noexcept
+		//
+		// The collisions along the paths of the bodies since the last check, every _collision_interval steps. The
+		// paths are taken as straight, from the locations at the last check to the ones at the end of the step
+		//
+		void iterate_broad_phase(const mass_bodies& current_gen, const mass_bodies& next_gen)
 		{
-			std::lock_guard l{ _collisions_mutex };
+			const int num_bodies{ static_cast<int>(next_gen.size()) };
+
+			// the bodies have changed (merged, escaped, loaded) since the last check
+			if (static_cast<int>(_collision_start_x.size()) != num_bodies)
+			{
+				_collision_start_x.assign(current_gen.x.begin(), current_gen.x.end());
+				_collision_start_y.assign(current_gen.y.begin(), current_gen.y.end());
+				_collision_start_z.assign(current_gen.z.begin(), current_gen.z.end());
+				_steps_since_collision_check = 0;
+			}
 
-			if (_collisions.empty())
+			if (++_steps_since_collision_check < _collision_interval)
+				return;
+
+			_broad_phase.find(
+				num_bodies,
+				_collision_start_x.data(),
+				_collision_start_y.data(),
+				_collision_start_z.data(),
+				next_gen.x.data(),
+				next_gen.y.data(),
+				next_gen.z.data(),
+				_props.radius.data(),
+				[&](int i, int j) { register_collisions(i, j); });
+
+			_collision_start_x.assign(next_gen.x.begin(), next_gen.x.end());
+			_collision_start_y.assign(next_gen.y.begin(), next_gen.y.end());
+			_collision_start_z.assign(next_gen.z.begin(), next_gen.z.end());
+			_steps_since_collision_check = 0;
+		}
+
+		//
+		// Merges the bodies in contact: the groups come from union-find over the contacts of all the workers, so they
+		// don't share any body, and are merged in parallel into their lowest index
+		//
+		void iterate_collision_merges() noexcept
+		{
+			if (_contacts.empty())
 				return;
 
 			check_generations_size_consistency();
 
 			const auto num_bodies{ _bodies_gens[0].size() };
 
-			std::vector<bool> idx_to_remove(num_bodies);
+			const auto& groups{ _contacts.gather(static_cast<int>(num_bodies)) };
+
+			arena_vector<char> idx_to_remove(num_bodies, 0, arena_allocator<char>{ scratch() });
 
 			auto& curr_gen = get_generation(0);
-			auto& next_gen = get_generation(1);
-			auto& prev0_gen = get_generation(-1);
-			auto& prev1_gen = get_generation(-2);
 
-			for (auto& collision : _collisions)
-			{
-				acc3d mass_location{};	// to calculate the resulting centre of mass 
-				acc3d mass_velocity{}; // to calculate the resulting momentum of motion 
-				acc3d force{};
+			_pool.parallel_for(0, static_cast<int>(groups.size()), 1,
+				[&](int g)
+				{
+					const auto& collision{ groups[g] };
 
-				std::string resulting_label;
+					acc3d mass_location{};	// to calculate the resulting centre of mass 
+					acc3d mass_velocity{}; // to calculate the resulting momentum of motion 
+					acc3d force{};
 
-				acc<double> total_mass{};
+					acc<double> total_mass{};
 
-				acc<double> total_vol_times_N{};
+					acc<double> total_vol_times_N{};
 
-				double max_temp{ 0 };
+					double max_temp{ 0 };
 
-				int dst_idx = *collision.begin();
-				for (auto& idx : collision)
-				{
-					if (idx != dst_idx)
+					const int dst_idx = collision.front();
+					for (auto& idx : collision)
 					{
-						idx_to_remove[idx] = true;
+						if (idx != dst_idx)
+						{
+							idx_to_remove[idx] = true;
+						}
+
+						const auto mass{ _props.mass[idx] };
+
+						mass_location  +=  curr_gen.location_value(idx) * mass;
+						mass_velocity  += curr_gen.velocity[idx].value * mass;
+						force += curr_gen.gravity_acceleration[idx].value * mass;
+
+						total_mass += mass;
+
+						total_vol_times_N += std::pow(_props.radius[idx], 3.0);
+						max_temp = std::max(max_temp, _props.temperature[idx]);
 					}
 
-					auto& body{ curr_gen[idx] };
+					_props.mass[dst_idx] = total_mass.value;
+					_props.mass_G[dst_idx] = total_mass.value * GRAVITATIONAL_CONSTANT;
+					_props.radius[dst_idx] = std::pow(total_vol_times_N.value, 1.0 / 3.0);
+					_props.temperature[dst_idx] = std::max(max_temp, 3000.0); // boiling planet's guts 
+
+					body_state c_dst{
+						acc3d{ mass_location.value / total_mass.value },
+						acc3d{ mass_velocity.value / total_mass.value },
+						acc3d{ force.value / total_mass.value }
+					};
+
+					// TODO: add labels here for labelled objects
+					for (auto& gen : _bodies_gens)
+					{
+						gen.set_state(dst_idx, c_dst);
+					}
+				});
 
-					mass_location  +=  body.location.value * body.mass;
-					mass_velocity  += body.velocity.value * body.mass;
-					force += body.gravity_acceleration.value * body.mass;
+			// the label of a merge only records the labels it is made of, the text is put together by the reports
+			for (const auto& collision : groups)
+			{
+				arena_vector<uint32_t> parts{ arena_allocator<uint32_t>{ scratch() } };
+				parts.reserve(collision.size());
 
-					total_mass += body.mass;
+				for (const int idx : collision)
+				{
+					auto label{ _props.label[idx] };
 
-					total_vol_times_N += std::pow(body.radius, 3.0);
-					max_temp = std::max(max_temp, body.temperature);
+					// the unlabelled bodies are named by their index
+					if (label == label_table::NO_LABEL)
+					{
+						label = _props.labels.intern(std::to_string(idx));
+					}
 
-					if (!resulting_label.empty())
-						resulting_label += "+";
-					resulting_label += !body.label.empty() ? body.label : std::to_string(idx);
+					parts.push_back(label);
 				}
 
-				auto& c_dst{ curr_gen[dst_idx] };
-				auto& n_dst{ next_gen[dst_idx] };
-				auto& p0_dst{ prev0_gen[dst_idx] };
-				auto& p1_dst{ prev1_gen[dst_idx] };
+				_props.label[collision.front()] = _props.labels.merged(parts);
+			}
 
-				c_dst.mass = total_mass.value;
-				c_dst.mass_G = c_dst.mass * GRAVITATIONAL_CONSTANT;
-				c_dst.radius = std::pow(total_vol_times_N.value, 1.0 / 3.0);
-				c_dst.location.value = mass_location.value / total_mass.value;
-				c_dst.velocity.value = mass_velocity.value / total_mass.value;
-				c_dst.gravity_acceleration = acc3d{ force.value / total_mass.value };
-				c_dst.temperature = std::max(max_temp, 3000.0); // boiling planet's guts 
-				c_dst.label = resulting_label;
+			auto remap{ remove_at(idx_to_remove) };
 
-				// TODO: add labels here for labelled objects
-				n_dst = c_dst;
-				p0_dst = c_dst;
-				p1_dst = c_dst;
+			// the merged bodies are followed into their merge
+			for (const auto& collision : groups)
+			{
+				for (const int idx : collision)
+				{
+					remap[idx] = remap[collision.front()];
+				}
 			}
 
-			_collisions.clear();
-			remove_at(idx_to_remove);
+			record_body_remap(remap);
 		}
 
 		void check_for_escaped_bodies() noexcept
@@ -397,21 +680,107 @@ namespace gravity
 
 			const auto num_bodies{ _bodies_gens[0].size() };
 
-			std::vector<bool> idx_to_remove(num_bodies);
+			arena_vector<char> idx_to_remove(num_bodies, 0, arena_allocator<char>{ scratch() });
 
 			auto& curr_gen = get_generation(0);
 
-			for (int i = 0; i < curr_gen.size(); ++ i)
+			_pool.parallel_for(0, static_cast<int>(curr_gen.size()),
+				[&](int i)
+				{
+					if (curr_gen.location_value(i).modulo() > DECLARE_ESCAPED_AT_DISTANCE)
+					{
+						idx_to_remove[i] = true;
+					}
+				});
+
+			if (const auto remap{ remove_at(idx_to_remove) }; !remap.empty())
+			{
+				record_body_remap(remap);
+			}
+
+			arena_vector<char> particles_to_remove(_particles.size(), 0, arena_allocator<char>{ scratch() });
+
+			_pool.parallel_for(0, static_cast<int>(_particles.size()),
+				[&](int p)
+				{
+					particles_to_remove[p] = _particles.location(p).modulo() > DECLARE_ESCAPED_AT_DISTANCE;
+				});
+
+			_particles.remove_at(particles_to_remove);
+		}
+
+		//
+		// The test particles over step, from the massive bodies of current_gen to the ones of next_gen, by kick-drift-
+		// kick leapfrog whatever the method of the massive bodies. The particles that hit a body are absorbed
+		//
+		void iterate_test_particles(const mass_bodies& current_gen, const mass_bodies& next_gen, double step) noexcept
+		{
+			const int num_particles{ static_cast<int>(_particles.size()) };
+
+			if (num_particles == 0)
+				return;
+
+			_particles_hit.resize(num_particles);
+
+			const int num_blocks{ (num_particles + TEST_PARTICLES_BLOCK - 1) / TEST_PARTICLES_BLOCK };
+
+			auto pull = [&](const mass_bodies& gen, int begin, int end)
 			{
-				const auto& b = curr_gen[i];
+				test_particles_pull(
+					_particles,
+					begin,
+					end,
+					static_cast<int>(gen.size()),
+					gen.x.data(),
+					gen.y.data(),
+					gen.z.data(),
+					_props.mass_G.data(),
+					_props.radius.data(),
+					_particles_hit.data());
+			};
 
-				if (b.location.value.modulo() > DECLARE_ESCAPED_AT_DISTANCE)
+			auto kick = [&](int begin, int end, double kick)
+			{
+				for (int p = begin; p < end; ++p)
 				{
-					idx_to_remove[i] = true;
+					_particles.vx[p] += _particles.ax[p] * kick;
+					_particles.vy[p] += _particles.ay[p] * kick;
+					_particles.vz[p] += _particles.az[p] * kick;
 				}
-			}
+			};
+
+			const bool acc_valid{ _particles.acc_valid };
+
+			_pool.parallel_for(0, num_blocks,
+				[&](int b)
+				{
+					const int begin{ b * TEST_PARTICLES_BLOCK };
+					const int end{ std::min(begin + TEST_PARTICLES_BLOCK, num_particles) };
+
+					if (!acc_valid)
+					{
+						pull(current_gen, begin, end);
+					}
+
+					kick(begin, end, step * 0.5);
+
+					for (int p = begin; p < end; ++p)
+					{
+						_particles.x[p] += _particles.vx[p] * step;
+						_particles.y[p] += _particles.vy[p] * step;
+						_particles.z[p] += _particles.vz[p] * step;
+					}
 
-			remove_at(idx_to_remove);
+					pull(next_gen, begin, end);
+					kick(begin, end, step * 0.5);
+				});
+
+			_particles.acc_valid = true;
+
+			if (std::find(_particles_hit.begin(), _particles_hit.end(), 1) != _particles_hit.end())
+			{
+				_particles.remove_at(_particles_hit);
+			}
 		}
 
 
@@ -427,280 +796,1904 @@ namespace gravity
 				on_bodies_vector_mismatch();
 			}
 
-			for (auto& o : next_gen)
-			{
-				o.gravity_acceleration = { 0.0, 0.0, 0.0 };
-			}
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+
+			const double* x{ current_gen.x.data() };
+			const double* y{ current_gen.y.data() };
+			const double* z{ current_gen.z.data() };
+			const double* mass_G{ _props.mass_G.data() };
+			const double* radius{ _props.radius.data() };
+
+			auto& next_acc{ next_gen.gravity_acceleration };
 
-			for (int i = 0; i < current_gen.size(); ++i)
+			next_acc.set_zero();
+
+			for (int i = 0; i < num_bodies; ++i)
 			{
-				const auto& curr_a{ current_gen[i] };
-				auto& next_a{ next_gen[i] };
+				const vec3d_pd loc_a{ x[i], y[i], z[i] };
+				auto next_acc_a{ next_acc[i] };
 
-				for (int j = i+1; j < current_gen.size(); ++j)
+				for (int j = i+1; j < num_bodies; ++j)
 				{
-					const auto& curr_b{ current_gen[j] };
-					auto& next_b{ next_gen[j] };
-
-					auto r_ba = curr_b.location.value - curr_a.location.value;
+					auto r_ba = vec3d_pd{ x[j], y[j], z[j] } - loc_a;
 					auto r_modulo = r_ba.modulo();
 
-					if (r_modulo > curr_a.radius + curr_b.radius)
-					{
-						auto r_mod_pow_3 = std::pow(r_modulo, 3.0);
-
-						next_a.gravity_acceleration += r_ba * (curr_b.mass_G / r_mod_pow_3);
-						next_b.gravity_acceleration += -r_ba * (curr_a.mass_G / r_mod_pow_3);
+					// the colliding pairs pull with nothing, they are found by iterate_broad_phase
+					auto r_mod_pow_3 = r_modulo > radius[i] + radius[j] ? std::pow(r_modulo, 3.0) : std::numeric_limits<double>::infinity();
 
-						if (r_modulo < curr_a.radius * 10)
-						{
-							next_a.temperature = std::max(curr_a.temperature, 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
-						}
+					next_acc_a += r_ba * (mass_G[j] / r_mod_pow_3);
+					next_acc[j] += -r_ba * (mass_G[i] / r_mod_pow_3);
 
-						if (r_modulo < curr_b.radius * 10)
-						{
-							next_b.temperature = std::max(curr_b.temperature, 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
-						}
+					if (r_modulo < radius[i] * 10)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
 					}
-					else
+
+					if (r_modulo < radius[j] * 10)
 					{
-						register_collisions(i, j);
+						_props.temperature[j] = std::max(_props.temperature[j], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
 					}
 				}
 			}
 
-			if (_current_iteration == 0)
-			{
-				prev1_gen = next_gen;
-				prev0_gen = next_gen;
-				current_gen = next_gen;
-			}
+			bootstrap_history(prev1_gen, prev0_gen, current_gen, next_gen);
 
-			for (int i = 0; i < current_gen.size(); ++i)
+			for (int i = 0; i < num_bodies; ++i)
 			{
-				iterate_move(prev1_gen[i], prev0_gen[i], current_gen[i], next_gen[i]);
+				iterate_move(prev1_gen, prev0_gen, current_gen, next_gen, i);
 			}
 		}
 		
-		void iterate_gravity_forces_mt(
-			const mass_bodies& prev1_gen,
-			const mass_bodies& prev0_gen,
+		//
+		// Pull of all the bodies onto the body i, using the packed kernel when it is selected
+		//
+		void iterate_body_pull(
 			const mass_bodies& current_gen,
 			mass_bodies& next_gen,
 			int i
 		) noexcept
 		{
-			const auto& curr_a{ current_gen[i] };
-			auto& next_a{ next_gen[i] };
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+
+			const double* x{ current_gen.x.data() };
+			const double* y{ current_gen.y.data() };
+			const double* z{ current_gen.z.data() };
+			const double* mass_G{ _props.mass_G.data() };
+			const double* radius{ _props.radius.data() };
+
+			if (SIMD_FORCE_KERNEL_AVAILABLE && _force_kernel == force_kernel::simd)
+			{
+				auto pull = simd_body_pull(i, num_bodies, x, y, z, mass_G, radius);
+
+				if (pull.tidal_heating)
+				{
+					_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+				}
 
-			next_a.gravity_acceleration = { 0.0, 0.0, 0.0 };
+				next_gen.gravity_acceleration[i] = acc3d{ pull.acceleration };
+				return;
+			}
+
+			const vec3d_pd loc_a{ x[i], y[i], z[i] };
+			const double radius_a{ radius[i] };
+
+			acc3d acc_a{ 0.0, 0.0, 0.0 };
 
-			for (int j = 0; j < current_gen.size(); ++j)
+			for (int j = 0; j < num_bodies; ++j)
 			{
 				if (i == j)
 				{
 					continue;
 				}
 
-				const auto& curr_b{ current_gen[j] };
-
-				auto r_ba = curr_b.location.value - curr_a.location.value;
+				auto r_ba = vec3d_pd{ x[j], y[j], z[j] } - loc_a;
 				auto r_modulo = r_ba.modulo();
 
-				if (r_modulo > curr_a.radius + curr_b.radius)
-				{
-					next_a.gravity_acceleration += r_ba * (curr_b.mass_G / std::pow(r_modulo, 3.0));
+				// the colliding pairs pull with nothing, they are found by iterate_broad_phase
+				acc_a += r_ba * (mass_G[j] / (r_modulo > radius_a + radius[j] ? std::pow(r_modulo, 3.0) : std::numeric_limits<double>::infinity()));
 
-					if (r_modulo < curr_a.radius * 10)
-					{
-						next_a.temperature = std::max(curr_a.temperature, 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
-					}
-				}
-				else
+				if (r_modulo < radius_a * 10)
 				{
-					register_collisions(i, j);
+					_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
 				}
 			}
 
-			iterate_move(prev1_gen[i], prev0_gen[i], curr_a, next_a);
+			next_gen.gravity_acceleration[i] = acc_a;
 		}
 
-		inline void iterate_linear(const mass_body& current, mass_body& next) noexcept
+		//
+		// Small N variant of the multithreaded step: every member of a persistent thread team takes a fixed slice of
+		// the bodies, pulls and moves them, so a whole step is a single team run. Each pair is evaluated twice here,
+		// but with a few dozen bodies the step is all synchronisation anyway
+		//
+		void iterate_gravity_forces_team(
+			const mass_bodies& prev1_gen,
+			const mass_bodies& prev0_gen,
+			const mass_bodies& current_gen,
+			mass_bodies& next_gen
+		) noexcept
 		{
-			next.velocity.value = current.velocity.value + next.gravity_acceleration.value * _time_delta;
-			next.location.value = current.location.value + next.velocity.value * _time_delta;
-		}
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+			const int team_size{ std::max(1, std::min(_num_worker_threads, num_bodies / TEAM_MIN_BODIES_PER_THREAD)) };
 
-		inline void iterate_linear_kahan(const mass_body& current, mass_body& next) noexcept
-		{
-			next.velocity = current.velocity + next.gravity_acceleration.value * _time_delta;
-			next.location = current.location + next.velocity.value * _time_delta;
-		}
+			if (!_team || _team->size() != team_size)
+			{
+				_team.reset();
+				_team = std::make_unique<thread_team>(team_size);
+			}
 
-		//
-		// This method uses the current value - v_0, previous v_1 and the one before v_2 to 
-		// interpolate the curve into quadratic equation, then using exact integration on the range from (t-time_delta/2, t+time_delta/2) we
-		// find the value of velocity / location change based on a quadratic approximation to the actual function
-		// 
-		inline void iterate_quadratic(const mass_body& prev0, const mass_body& current, mass_body& next) noexcept
-		{
-			next.velocity.value = current.velocity.value
-				+ (
-					25 * next.gravity_acceleration.value
-					- 2 * current.gravity_acceleration.value
-					+ prev0.gravity_acceleration.value
-				) * _time_delta_times_1_24;
-			next.location.value = current.location.value + 
-				(
-					25 * next.velocity.value + 
-					- 2 * current.velocity.value 
-					+ prev0.velocity.value
-				) * _time_delta_times_1_24;
+			auto step = [&](int member, int size)
+			{
+				const int i_begin{ num_bodies * member / size };
+				const int i_end{ num_bodies * (member + 1) / size };
+
+				for (int i = i_begin; i < i_end; ++i)
+				{
+					iterate_body_pull(current_gen, next_gen, i);
+					iterate_move(prev1_gen, prev0_gen, current_gen, next_gen, i);
+				}
+			};
+
+			_team->run(step);
 		}
 
 		//
-		// Same as above, but using Kahan accumulators for velocity / location 
+		// Pull of the bodies of block [j_begin, j_end) onto the bodies of block [i_begin, i_end) and vice versa,
+		// using the same j > i symmetry as iterate_gravity_forces. When both blocks are the same, this is the triangle
 		//
-		inline void iterate_quadratic_kahan(const mass_body& prev0, const mass_body& current, mass_body& next) noexcept
+		void iterate_gravity_forces_block_pair(
+			mass_bodies& next_gen,
+			const mass_bodies& current_gen,
+			int i_begin, int i_end,
+			int j_begin, int j_end
+		) noexcept
 		{
-			next.velocity = current.velocity
-				+ (
-					25 * next.gravity_acceleration.value 
-					- 2 * current.gravity_acceleration.value 
-					+ prev0.gravity_acceleration.value
-				) * _time_delta_times_1_24;
-			next.location = current.location +
-				(
-					25 * next.velocity.value +
-					-2 * current.velocity.value
-					+ prev0.velocity.value
-				) * _time_delta_times_1_24;
-		}
+			const double* x{ current_gen.x.data() };
+			const double* y{ current_gen.y.data() };
+			const double* z{ current_gen.z.data() };
+			const double* mass_G{ _props.mass_G.data() };
+			const double* radius{ _props.radius.data() };
 
-		//
-		// This method is similar to quadratic, but using more history points and interpolates into cubic function 
-		// 
-		inline void iterate_cubic(const mass_body& prev1, const mass_body& prev0, const mass_body& current, mass_body& next) noexcept
-		{
-			next.velocity.value = current.velocity.value +
-				(
-					26 * next.gravity_acceleration.value
-					+ (-5) * current.gravity_acceleration.value
-					+ 4 * prev0.gravity_acceleration.value
-					+ (-1)* prev1.gravity_acceleration.value
-				) * _time_delta_times_1_24;
+			auto& next_acc{ next_gen.gravity_acceleration };
 
-			next.location.value = current.location.value +
-				(
-					26 * next.velocity.value 
-					+ (-5) * current.velocity.value 
-					+ 4 * prev0.velocity.value
-					+ (-1) * prev1.velocity.value
-				) * _time_delta_times_1_24;
-		}
+			const bool same_block{ i_begin == j_begin };
 
-		//
-		// This method is similar to quadratic, but using more history points and interpolates into cubic function 
-		// 
-		inline void iterate_cubic_kahan(const mass_body& prev1, const mass_body& prev0, const mass_body& current, mass_body& next) noexcept
-		{
-			next.velocity = current.velocity +
-				(
-					26 * next.gravity_acceleration.value
-					+ (-5) * current.gravity_acceleration.value
-					+ 4 * prev0.gravity_acceleration.value
-					+ (-1) * prev1.gravity_acceleration.value
-				) * _time_delta_times_1_24;
+			for (int i = i_begin; i < i_end; ++i)
+			{
+				const vec3d_pd loc_a{ x[i], y[i], z[i] };
+				auto next_acc_a{ next_acc[i] };
 
-			next.location = current.location +
-				(
-					26 * next.velocity.value
-					+ (-5) * current.velocity.value
-					+ 4 * prev0.velocity.value
-					+ (-1) * prev1.velocity.value
-				) * _time_delta_times_1_24;
-		}
+				for (int j = same_block ? i + 1 : j_begin; j < j_end; ++j)
+				{
+					auto r_ba = vec3d_pd{ x[j], y[j], z[j] } - loc_a;
+					auto r_modulo = r_ba.modulo();
+
+					// the colliding pairs pull with nothing, they are found by iterate_broad_phase
+					auto r_mod_pow_3 = r_modulo > radius[i] + radius[j] ? std::pow(r_modulo, 3.0) : std::numeric_limits<double>::infinity();
+
+					next_acc_a += r_ba * (mass_G[j] / r_mod_pow_3);
+					next_acc[j] += -r_ba * (mass_G[i] / r_mod_pow_3);
+
+					if (r_modulo < radius[i] * 10)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
 
+					if (r_modulo < radius[j] * 10)
+					{
+						_props.temperature[j] = std::max(_props.temperature[j], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
+				}
+			}
+		}
 
-		void iterate_move(const mass_body& prev1, const mass_body& prev0, const mass_body& current, mass_body& next) noexcept
+		//
+		// Multithreaded variant of iterate_gravity_forces, evaluating every pair only once.
+		//
+		// The bodies are split into an even number of blocks, and the block pairs are scheduled as a round robin
+		// tournament: in every round each block takes part in exactly one pair, so the tasks of a round never touch
+		// the same body, and the accelerations can be accumulated in place with no locks or reduction afterwards.
+		// The triangles of the blocks themselves are done in the first round
+		//
+		void iterate_gravity_forces_symmetric_mt(
+			const mass_bodies& prev1_gen,
+			const mass_bodies& prev0_gen,
+			const mass_bodies& current_gen,
+			mass_bodies& next_gen
+		) noexcept
 		{
-			if constexpr (method == integration_method::linear)
+			if (current_gen.size() != next_gen.size())
 			{
-				iterate_linear(current, next);
+				on_bodies_vector_mismatch();
 			}
-			else if constexpr (method == integration_method::linear_kahan)
-			{
-				iterate_linear_kahan(current, next);
+
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+
+			next_gen.gravity_acceleration.set_zero();
+
+			const int max_blocks{ _pool.num_threads() * SYMMETRIC_BLOCKS_PER_THREAD };
+			const int num_blocks{ std::max(2, std::min(max_blocks, num_bodies / SYMMETRIC_MIN_BLOCK_SIZE) & ~1) };
+			const int num_rounds{ num_blocks - 1 };
+
+			auto block_begin = [&](int b) { return static_cast<int>(static_cast<int64_t>(b) * num_bodies / num_blocks); };
+
+			for (int round = 0; round < num_rounds; ++round)
+			{
+				_pool.parallel_for(0, num_blocks / 2,
+					[&](int k)
+					{
+						// circle method: the last block stays in place, the others rotate around it
+						const int a{ k == 0 ? num_rounds : (round + k) % num_rounds };
+						const int b{ (round - k + num_rounds) % num_rounds };
+
+						if (round == 0)
+						{
+							iterate_gravity_forces_block_pair(next_gen, current_gen, block_begin(a), block_begin(a + 1), block_begin(a), block_begin(a + 1));
+							iterate_gravity_forces_block_pair(next_gen, current_gen, block_begin(b), block_begin(b + 1), block_begin(b), block_begin(b + 1));
+						}
+
+						iterate_gravity_forces_block_pair(next_gen, current_gen, block_begin(a), block_begin(a + 1), block_begin(b), block_begin(b + 1));
+					});
+			}
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					iterate_move(prev1_gen, prev0_gen, current_gen, next_gen, i);
+				});
+		}
+
+		//
+		// Cache blocked variant of the force evaluation: one task per block of _tile_shape.i_block bodies,
+		// which are then moved as soon as their accelerations are known
+		//
+		void iterate_gravity_forces_tiled(
+			const mass_bodies& prev1_gen,
+			const mass_bodies& prev0_gen,
+			const mass_bodies& current_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+			const int i_block{ _tile_shape.i_block };
+			const int num_blocks{ (num_bodies + i_block - 1) / i_block };
+
+			_pool.parallel_for(0, num_blocks,
+				[&](int b)
+				{
+					const int i_begin{ b * i_block };
+					const int i_end{ std::min(i_begin + i_block, num_bodies) };
+
+					std::array<vec3d_pd, tile_shape::MAX_I_BLOCK> acc;
+
+					tiled_block_pull(
+						i_begin,
+						i_end,
+						_tile_shape.j_tile,
+						num_bodies,
+						current_gen.x.data(),
+						current_gen.y.data(),
+						current_gen.z.data(),
+						_props.mass_G.data(),
+						_props.radius.data(),
+						acc.data(),
+						[&](int i) { _props.temperature[i] = std::max(_props.temperature[i], 1000.0); }); // tidal forces stirr the mantel, floor is lava in the whole planet now
+
+					for (int i = i_begin; i < i_end; ++i)
+					{
+						next_gen.gravity_acceleration[i] = acc3d{ acc[i - i_begin] };
+
+						iterate_move(prev1_gen, prev0_gen, current_gen, next_gen, i);
+					}
+				});
+		}
+
+		//
+		// Tree based variant of the force evaluation (Barnes-Hut or FMM): the engine is rebuilt from the current
+		// generation, then the accelerations are evaluated in parallel, one body per task
+		//
+		template <typename TTreeEngine>
+		void iterate_gravity_forces_tree(
+			TTreeEngine& engine,
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& current_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			engine.build(current_gen, _props);
+
+			_pool.parallel_for(0, engine.size(),
+				[&](int k)
+				{
+					const int i{ engine.body_at(k) };
+					bool tidal_heating{ false };
+
+					auto acc = engine.acceleration(k,
+						[&](int j) { register_collisions(i, j); },
+						[&]() { tidal_heating = true; });
+
+					if (tidal_heating)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
+
+					next_gen.gravity_acceleration[i] = acc3d{ acc };
+				});
+
+			bootstrap_history(prev1_gen, prev0_gen, current_gen, next_gen);
+
+			_pool.parallel_for(0, static_cast<int>(current_gen.size()),
+				[&](int i)
+				{
+					iterate_move(prev1_gen, prev0_gen, current_gen, next_gen, i);
+				});
+		}
+
+		//
+		// The multistep methods have no history on the first iteration, it is faked with the first forces. All the
+		// generations start from the same registered bodies, so only the velocities and the accelerations are copied
+		//
+		void bootstrap_history(
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& current_gen,
+			const mass_bodies& next_gen
+		)
+		{
+			if constexpr (history_depth(method) > 0)
+			{
+				if (_current_iteration == 0)
+				{
+					for (auto* gen : { &prev1_gen, &prev0_gen, &current_gen })
+					{
+						gen->velocity = next_gen.velocity;
+						gen->gravity_acceleration = next_gen.gravity_acceleration;
+					}
+				}
+			}
+		}
+
+		void iterate_move(
+			const mass_bodies& prev1_gen,
+			const mass_bodies& prev0_gen,
+			const mass_bodies& current_gen,
+			mass_bodies& next_gen,
+			int i
+		) noexcept
+		{
+			const auto current{ current_gen.get_state(i) };
+			auto next{ next_gen.get_state(i) };
+
+			if constexpr (uses_kick_drift(method))
+			{
+				kick_drift(current, next, i != _central_body ? _stage_kick : 0.0, _stage_drift);
+			}
+			else
+			{
+				body_state prev0{};
+				body_state prev1{};
+
+				// the integrators only read the past velocities and accelerations
+				if constexpr (history_depth(method) >= 1)
+				{
+					prev0.velocity = prev0_gen.velocity[i];
+					prev0.gravity_acceleration = prev0_gen.gravity_acceleration[i];
+				}
+
+				if constexpr (history_depth(method) >= 2)
+				{
+					prev1.velocity = prev1_gen.velocity[i];
+					prev1.gravity_acceleration = prev1_gen.gravity_acceleration[i];
+				}
+
+				integrate<method>(prev1, prev0, current, next, _time_delta, _time_delta_times_1_24);
+			}
+
+			next_gen.set_state(i, next);
+		}
+
+		void iterate_forces_and_moves() noexcept
+		{
+			auto p1_idx = (_current_iteration + NUM_GENERATIONS - 2) % NUM_GENERATIONS;
+			auto p0_idx = (p1_idx + 1) % NUM_GENERATIONS;
+			auto c_idx = (p0_idx + 1) % NUM_GENERATIONS;
+			auto n_idx = (c_idx + 1) % NUM_GENERATIONS;
+
+			auto& prev1_gen = _bodies_gens[p1_idx];
+			auto& prev0_gen = _bodies_gens[p0_idx];
+			auto& curr_gen = _bodies_gens[c_idx];
+			auto& next_gen = _bodies_gens[n_idx];
+
+			if constexpr (method == integration_method::wisdom_holman)
+			{
+				iterate_wisdom_holman(prev1_gen, prev0_gen, curr_gen, next_gen);
+			}
+			else if constexpr (is_symplectic(method))
+			{
+				iterate_composition(prev1_gen, prev0_gen, curr_gen, next_gen);
+			}
+			else if constexpr (is_adaptive(method))
+			{
+				iterate_bulirsch_stoer(prev1_gen, prev0_gen, curr_gen, next_gen);
+			}
+			else if constexpr (has_block_steps(method))
+			{
+				iterate_block_steps(prev0_gen, curr_gen, next_gen);
+			}
+			else if constexpr (method == integration_method::respa)
+			{
+				iterate_respa(curr_gen, next_gen);
+			}
+			else if constexpr (method == integration_method::hierarchical)
+			{
+				iterate_hierarchical(curr_gen, next_gen);
+			}
+			else if constexpr (method == integration_method::ks_regularized)
+			{
+				iterate_ks_regularized(prev0_gen, curr_gen, next_gen);
+			}
+			else
+			{
+				iterate_forces_and_moves(prev1_gen, prev0_gen, curr_gen, next_gen);
+			}
+		}
+
+		//
+		// Forces at the current_gen locations into next_gen, and the move from current_gen to next_gen
+		//
+		void iterate_forces_and_moves(
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			if (_force_engine == force_engine::barnes_hut)
+			{
+				iterate_gravity_forces_tree(_tree, prev1_gen, prev0_gen, curr_gen, next_gen);
+				return;
+			}
+			else if (_force_engine == force_engine::fmm)
+			{
+				iterate_gravity_forces_tree(_fmm, prev1_gen, prev0_gen, curr_gen, next_gen);
+				return;
+			}
+			
+			bool use_mt = (_mt_ticks_per_n_iter < _st_ticks_per_n_iter);
+
+			auto sub_iter{ _current_iteration % PERFORMANCE_PROFILING_CYCLE };
+			bool profiling_iter{ sub_iter < PERFORMANCE_PROFILING_N * 2 };
+
+			if (profiling_iter)
+			{
+				if (sub_iter == 0)
+				{
+					_st_ticks_per_n_iter = 0;
+					_mt_ticks_per_n_iter = 0;
+				}
+				use_mt = sub_iter < PERFORMANCE_PROFILING_N;
+			}			
+
+			uint64_t start = __rdtsc();
+			if (!use_mt || _current_iteration == 0)
+			{
+				iterate_gravity_forces(prev1_gen, prev0_gen, curr_gen, next_gen);
+
+				if (profiling_iter)
+					_st_ticks_per_n_iter += __rdtsc() - start;
+			}
+			else if (curr_gen.size() <= TEAM_MAX_BODIES)
+			{
+				iterate_gravity_forces_team(prev1_gen, prev0_gen, curr_gen, next_gen);
+
+				if (profiling_iter)
+					_mt_ticks_per_n_iter += __rdtsc() - start;
+			}
+			else if (SIMD_FORCE_KERNEL_AVAILABLE && _force_kernel == force_kernel::simd)
+			{
+				_pool.parallel_for(0, static_cast<int>(curr_gen.size()),
+					[&](int i)
+					{
+						iterate_body_pull(curr_gen, next_gen, i);
+						iterate_move(prev1_gen, prev0_gen, curr_gen, next_gen, i);
+					});
+
+				if (profiling_iter)
+					_mt_ticks_per_n_iter += __rdtsc() - start;
+			}
+			else if (_force_kernel == force_kernel::tiled)
+			{
+				iterate_gravity_forces_tiled(prev1_gen, prev0_gen, curr_gen, next_gen);
+
+				if (profiling_iter)
+					_mt_ticks_per_n_iter += __rdtsc() - start;
+			}
+			else
+			{
+				iterate_gravity_forces_symmetric_mt(prev1_gen, prev0_gen, curr_gen, next_gen);
+
+				if (profiling_iter)
+					_mt_ticks_per_n_iter += __rdtsc() - start;
+			}
+
+		}
+
+		//
+		// kick_drift of every body of the generation with the accelerations it has, no force evaluation
+		//
+		void kick_drift_all(mass_bodies& gen, double kick, double drift) noexcept
+		{
+			_pool.parallel_for(0, static_cast<int>(gen.size()),
+				[&](int i)
+				{
+					auto state{ gen.get_state(i) };
+					kick_drift(state, state, kick, drift);
+					gen.set_state(i, state);
+				});
+		}
+
+		//
+		// The symplectic stages reuse the acceleration at the current locations from the last stage of the previous
+		// step. It's not there on the first step, nor once a merge or an escape changed the bodies
+		//
+		void ensure_symplectic_accelerations(mass_bodies& scratch_gen, mass_bodies& curr_gen, mass_bodies& next_gen) noexcept
+		{
+			if (_symplectic_acc_size == curr_gen.size())
+				return;
+
+			_stage_kick = 0.0;
+			_stage_drift = 0.0;
+
+			iterate_forces_and_moves(scratch_gen, scratch_gen, curr_gen, next_gen);
+
+			curr_gen.gravity_acceleration = next_gen.gravity_acceleration;
+			_symplectic_acc_size = curr_gen.size();
+		}
+
+		//
+		// Yoshida composition of kick-drift-kick leapfrog steps. The half kicks of adjacent stages are fused, so with
+		// the acceleration kept from the previous step every stage costs a single force evaluation.
+		//
+		// curr_gen is left as it is, as the merges and the reports work on it. The stages ping-pong between prev0_gen
+		// and next_gen instead, the history isn't needed here
+		//
+		void iterate_composition(
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			constexpr auto weights{ composition_weights<method>() };
+			constexpr int num_stages{ static_cast<int>(weights.size()) };
+
+			static_assert(num_stages % 2 == 1, "The last stage has to land in next_gen");
+
+			ensure_symplectic_accelerations(prev1_gen, curr_gen, next_gen);
+
+			prev0_gen = curr_gen;
+			kick_drift_all(prev0_gen, weights[0] * _time_delta_times_1_2, weights[0] * _time_delta);
+
+			mass_bodies* source{ &prev0_gen };
+			mass_bodies* destination{ &next_gen };
+
+			for (int stage = 0; stage < num_stages; ++stage)
+			{
+				const bool last{ stage == num_stages - 1 };
+
+				_stage_kick = (last ? weights[stage] : weights[stage] + weights[stage + 1]) * _time_delta_times_1_2;
+				_stage_drift = last ? 0.0 : weights[stage + 1] * _time_delta;
+
+				iterate_forces_and_moves(prev1_gen, prev1_gen, *source, *destination);
+
+				std::swap(source, destination);
+			}
+		}
+
+		//
+		// Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison & Lee 1998). The orbits around the
+		// central (most massive) body are advanced exactly by Kepler drifts, only the much weaker interactions between
+		// the other bodies are integrated, so the step is limited by these rather than by the shortest orbit.
+		//
+		// kick(dt/2) - jump(dt/2) - kepler(dt) - jump(dt/2) - kick(dt/2), the central body's mass is held out of the
+		// force kernels for the kicks, which leaves the interactions only
+		//
+		void iterate_wisdom_holman(
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			if (curr_gen.size() == 0)
+				return;
+
+			const int central{ static_cast<int>(std::max_element(_props.mass.begin(), _props.mass.end()) - _props.mass.begin()) };
+
+			if (central != _central_body)
+			{
+				_central_body = central;
+				_symplectic_acc_size = 0;
+			}
+
+			const double central_mass_G{ _props.mass_G[central] };
+
+			_props.mass_G[central] = 0.0;
+			ensure_symplectic_accelerations(prev1_gen, curr_gen, next_gen);
+
+			prev0_gen = curr_gen;
+
+			for (int i = 0; i < static_cast<int>(prev0_gen.size()); ++i)
+			{
+				if (i != central)
+				{
+					prev0_gen.velocity[i] += prev0_gen.gravity_acceleration[i].value * _time_delta_times_1_2;
+				}
+			}
+
+			_props.mass_G[central] = central_mass_G;
+			wisdom_holman_drift(prev0_gen, central);
+
+			_props.mass_G[central] = 0.0;
+
+			_stage_kick = _time_delta_times_1_2;
+			_stage_drift = 0.0;
+
+			iterate_forces_and_moves(prev1_gen, prev1_gen, prev0_gen, next_gen);
+
+			_props.mass_G[central] = central_mass_G;
+		}
+
+		//
+		// jump(dt/2) - kepler(dt) - jump(dt/2) of the Wisdom-Holman map, in place.
+		//
+		// The democratic heliocentric coordinates are the locations relative to the central body, and the velocities
+		// relative to the centre of mass; the centre of mass keeps its velocity and the central body follows from it
+		//
+		void wisdom_holman_drift(mass_bodies& gen, int central) noexcept
+		{
+			const int num_bodies{ static_cast<int>(gen.size()) };
+
+			const double central_mass{ _props.mass[central] };
+			const double mu{ _props.mass_G[central] };
+
+			acc3d mass_location{};
+			acc3d mass_velocity{};
+			acc<double> total_mass{};
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				mass_location += gen.location_value(i) * _props.mass[i];
+				mass_velocity += gen.velocity[i].value * _props.mass[i];
+				total_mass += _props.mass[i];
+			}
+
+			const vec3d_pd centre_of_mass{ mass_location.value / total_mass.value };
+			const vec3d_pd centre_of_mass_velocity{ mass_velocity.value / total_mass.value };
+
+			const vec3d_pd central_location{ gen.location_value(central) };
+
+			arena_vector<vec3d_pd> location(num_bodies, arena_allocator<vec3d_pd>{ scratch() });
+			arena_vector<vec3d_pd> velocity(num_bodies, arena_allocator<vec3d_pd>{ scratch() });
+
+			vec3d_pd momentum{ 0.0, 0.0, 0.0 };
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				location[i] = gen.location_value(i) - central_location;
+				velocity[i] = gen.velocity[i].value - centre_of_mass_velocity;
+
+				if (i != central)
+				{
+					momentum += velocity[i] * _props.mass[i];
+				}
+			}
+
+			const vec3d_pd jump_before{ momentum * (_time_delta_times_1_2 / central_mass) };
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					if (i == central)
+						return;
+
+					location[i] += jump_before;
+					kepler_drift::apply(location[i], velocity[i], mu, _time_delta);
+				});
+
+			// the drifts changed the momentum, the second jump goes with the new one
+			momentum = { 0.0, 0.0, 0.0 };
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				if (i != central)
+				{
+					momentum += velocity[i] * _props.mass[i];
+				}
+			}
+
+			const vec3d_pd jump_after{ momentum * (_time_delta_times_1_2 / central_mass) };
+
+			// back to the inertial frame
+			vec3d_pd mass_offset{ 0.0, 0.0, 0.0 };
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				if (i != central)
+				{
+					location[i] += jump_after;
+					mass_offset += location[i] * _props.mass[i];
+				}
+			}
+
+			const vec3d_pd new_central_location{ centre_of_mass + centre_of_mass_velocity * _time_delta - mass_offset / total_mass.value };
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				if (i == central)
+				{
+					gen.set_location(i, acc3d{ new_central_location });
+					gen.velocity[i] = acc3d{ centre_of_mass_velocity - momentum / central_mass };
+				}
+				else
+				{
+					gen.set_location(i, acc3d{ new_central_location + location[i] });
+					gen.velocity[i] = acc3d{ centre_of_mass_velocity + velocity[i] };
+				}
+			}
+		}
+
+		double report_period() const noexcept
+		{
+			return static_cast<double>(_report_every_n_iterations) * _time_delta;
+		}
+
+		double end_time() const noexcept
+		{
+			return static_cast<double>(_max_iterations) * _time_delta;
+		}
+
+		//
+		// Gragg-Bulirsch-Stoer. The step is taken by leapfrog in 2, 4, 6, ... substeps, and the results are
+		// extrapolated to a zero substep (the error of leapfrog is a series in even powers of the substep). The
+		// difference of the last two extrapolations estimates the error: the step is accepted as soon as it meets
+		// the tolerance, and is retried shorter when none of them does. The next step is then sized to meet the
+		// tolerance again, so the quiet periods go at long steps, and the close encounters at short ones.
+		//
+		// The steps are cut short to land exactly on the report times and on the end of the run, which are the
+		// multiples of report_every_n * time_delta and max_iterations * time_delta as with the fixed steps.
+		// time_delta is the first step to try
+		//
+		void iterate_bulirsch_stoer(
+			mass_bodies& prev1_gen,
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			const double period{ report_period() };
+
+			_next_report_time = period > 0.0
+				? (std::floor(_simulation_time / period * (1.0 + 1e-12)) + 1.0) * period
+				: std::numeric_limits<double>::infinity();
+
+			const double next_event{ std::min(_next_report_time, end_time()) };
+
+			if (_adaptive_step <= 0.0)
+			{
+				_adaptive_step = _time_delta;
+			}
+
+			// the accelerations at the start are shared by all the substep sequences
+			_stage_kick = 0.0;
+			_stage_drift = 0.0;
+			iterate_forces_and_moves(prev1_gen, prev1_gen, curr_gen, prev0_gen);
+
+			while (true)
+			{
+				const bool clipped{ _simulation_time + _adaptive_step >= next_event };
+				const double step{ clipped ? next_event - _simulation_time : _adaptive_step };
+
+				double error{ 0.0 };
+				int column{ 0 };
+
+				const bool accepted{ bulirsch_stoer_step(prev0_gen, prev1_gen, next_gen, step, error, column) };
+
+				// order 2 * column + 2, hence the local error goes with step ^ (2 * column + 3)
+				double factor{ BS_SAFETY * std::pow(1.0 / std::max(error, 1e-30), 1.0 / (2 * column + 3)) };
+
+				if (!std::isfinite(factor))
+				{
+					factor = BS_MIN_FACTOR;
+				}
+
+				factor = std::clamp(factor, BS_MIN_FACTOR, BS_MAX_FACTOR);
+
+				if (accepted || step <= _time_delta * BS_MIN_STEP_FRACTION)
+				{
+					_simulation_time = clipped ? next_event : _simulation_time + step;
+
+					// a step cut short for a report says little about the next one
+					_adaptive_step = clipped ? std::max(_adaptive_step, step * factor) : step * factor;
+					return;
+				}
+
+				_adaptive_step = step * std::min(factor, 0.5);
+			}
+		}
+
+		//
+		// Leapfrog over step in the given (even) number of substeps, from base into result. base has the
+		// accelerations at its locations
+		//
+		void leapfrog_substeps(const mass_bodies& base, mass_bodies& scratch, mass_bodies& result, double step, int substeps) noexcept
+		{
+			const double h{ step / substeps };
+
+			result = base;
+			kick_drift_all(result, h * 0.5, h);
+
+			mass_bodies* source{ &result };
+			mass_bodies* destination{ &scratch };
+
+			for (int substep = 1; substep <= substeps; ++substep)
+			{
+				const bool last{ substep == substeps };
+
+				_stage_kick = last ? h * 0.5 : h;
+				_stage_drift = last ? 0.0 : h;
+
+				iterate_forces_and_moves(scratch, scratch, *source, *destination);
+
+				std::swap(source, destination);
+			}
+		}
+
+		//
+		// The extrapolation of a single step into result, returns whether it met the tolerance. error is relative to
+		// the tolerance, column is the last column of the extrapolation that was reached
+		//
+		bool bulirsch_stoer_step(const mass_bodies& base, mass_bodies& scratch, mass_bodies& result, double step, double& error, int& column) noexcept
+		{
+			const int num_bodies{ static_cast<int>(base.size()) };
+
+			for (auto& values : _bs_columns)
+			{
+				values.resize(6 * static_cast<size_t>(num_bodies));
+			}
+			_bs_body_error.resize(num_bodies);
+
+			for (column = 0; column < BS_MAX_COLUMNS; ++column)
+			{
+				const int substeps{ 2 * (column + 1) };
+
+				leapfrog_substeps(base, scratch, result, step, substeps);
+
+				_pool.parallel_for(0, num_bodies,
+					[&](int i)
+					{
+						const vec3d_pd location{ result.location_value(i) };
+						const vec3d_pd velocity{ result.velocity[i].value };
+						const double raw[6]{ location.x(), location.y(), location.z(), velocity.x(), velocity.y(), velocity.z() };
+
+						// Neville's scheme in place, _bs_columns[j] goes from T(column - 1, j) to T(column, j)
+						for (int e = 0; e < 6; ++e)
+						{
+							const size_t idx{ 6 * static_cast<size_t>(i) + e };
+							double current{ raw[e] };
+
+							for (int j = 1; j <= column; ++j)
+							{
+								const double ratio{ static_cast<double>(substeps) / (2 * (column - j + 1)) };
+								const double next_value{ current + (current - _bs_columns[j - 1][idx]) / (ratio * ratio - 1.0) };
+
+								_bs_columns[j - 1][idx] = current;
+								current = next_value;
+							}
+
+							_bs_columns[column][idx] = current;
+						}
+
+						if (column == 0)
+							return;
+
+						// error relative to the body's own location / velocity, plus what it covers within the step
+						const auto& best{ _bs_columns[column] };
+						const auto& second{ _bs_columns[column - 1] };
+						const size_t idx{ 6 * static_cast<size_t>(i) };
+
+						const vec3d_pd location_error{ best[idx] - second[idx], best[idx + 1] - second[idx + 1], best[idx + 2] - second[idx + 2] };
+						const vec3d_pd velocity_error{ best[idx + 3] - second[idx + 3], best[idx + 4] - second[idx + 4], best[idx + 5] - second[idx + 5] };
+
+						const double base_speed{ base.velocity[i].value.modulo() };
+						const double location_scale{ base.location_value(i).modulo() + base_speed * step };
+						const double velocity_scale{ base_speed + base.gravity_acceleration[i].value.modulo() * step };
+
+						_bs_body_error[i] = std::max(
+							location_error.modulo() / std::max(location_scale, std::numeric_limits<double>::min()),
+							velocity_error.modulo() / std::max(velocity_scale, std::numeric_limits<double>::min()));
+					});
+
+				if (column == 0)
+					continue;
+
+				error = 0.0;
+				for (const auto body_error : _bs_body_error)
+				{
+					error = std::max(error, body_error);
+				}
+				error /= _tolerance;
+
+				if (error <= 1.0 || column == BS_MAX_COLUMNS - 1)
+					break;
+			}
+
+			const auto& best{ _bs_columns[column] };
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					const size_t idx{ 6 * static_cast<size_t>(i) };
+
+					result.set_location(i, acc3d{ best[idx], best[idx + 1], best[idx + 2] });
+					result.velocity[i] = acc3d{ best[idx + 3], best[idx + 4], best[idx + 5] };
+				});
+
+			return error <= 1.0;
+		}
+
+		//
+		// Block timesteps (Aarseth): every body has its own step of time_delta / 2^level, so a close pair is stepped
+		// finely without holding up the rest. The levels line up, so the substeps of time_delta go block by block:
+		// the bodies due at the block time get their forces evaluated and their state corrected, all the others are
+		// only predicted to it to pull on them. The work of a block is thus proportional to the number of the bodies
+		// in it.
+		//
+		// The predictor is the Taylor series with the acceleration and its derivative, see correct_block_body for the
+		// correctors and the step criteria of the methods. Every iterate ends with all the bodies at the next
+		// time_delta, which is the longest step
+		//
+		void iterate_block_steps(
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			const int num_bodies{ static_cast<int>(curr_gen.size()) };
+			const double tick{ _time_delta / static_cast<double>(block_steps::TICKS) };
+
+			// prev0_gen keeps the corrected state of every body at its own time, next_gen the predictions at the block time
+			prev0_gen = curr_gen;
+			next_gen = curr_gen;
+
+			if (_block.size() != curr_gen.size())
+			{
+				start_block_steps(prev0_gen, next_gen);
+			}
+
+			std::fill(_block.time.begin(), _block.time.end(), 0);
+
+			while (true)
+			{
+				uint64_t block_time{ block_steps::TICKS + 1 };
+
+				for (int i = 0; i < num_bodies; ++i)
+				{
+					block_time = std::min(block_time, _block.time[i] + block_steps::ticks(_block.level[i]));
+				}
+
+				if (block_time > block_steps::TICKS)
+					break;
+
+				_block_active.clear();
+
+				for (int i = 0; i < num_bodies; ++i)
+				{
+					if (_block.time[i] + block_steps::ticks(_block.level[i]) == block_time)
+					{
+						_block_active.push_back(i);
+					}
+				}
+
+				_pool.parallel_for(0, num_bodies,
+					[&](int i)
+					{
+						const double dt{ static_cast<double>(block_time - _block.time[i]) * tick };
+						const vec3d_pd a{ prev0_gen.gravity_acceleration[i].value };
+						const vec3d_pd v{ prev0_gen.velocity[i].value };
+						const vec3d_pd& jerk{ _block.jerk[i] };
+
+						const vec3d_pd predicted_velocity{ v + (a + jerk * (dt * 0.5)) * dt };
+
+						next_gen.set_location(i, acc3d{ prev0_gen.location_value(i) + (v + (a * 0.5 + jerk * (dt / 6.0)) * dt) * dt });
+						next_gen.velocity[i] = acc3d{ predicted_velocity };
+
+						_block.vx[i] = predicted_velocity.x();
+						_block.vy[i] = predicted_velocity.y();
+						_block.vz[i] = predicted_velocity.z();
+					});
+
+				_pool.parallel_for(0, static_cast<int>(_block_active.size()),
+					[&](int k)
+					{
+						const int i{ _block_active[k] };
+						const double dt{ static_cast<double>(block_steps::ticks(_block.level[i])) * tick };
+
+						const int level{ correct_block_body(i, prev0_gen, next_gen, dt) };
+
+						_block.time[i] = block_time;
+						_block.level[i] = block_steps::next_level(_block.level[i], level, block_time);
+					});
+			}
+
+			std::swap(prev0_gen, next_gen);
+		}
+
+		//
+		// The accelerations (and jerks) at the start, and the levels from them. Again whenever the bodies change, as
+		// with merges or escapes
+		//
+		void start_block_steps(mass_bodies& prev0_gen, const mass_bodies& next_gen) noexcept
+		{
+			const int num_bodies{ static_cast<int>(next_gen.size()) };
+
+			_block.resize(num_bodies);
+
+			for (int i = 0; i < num_bodies; ++i)
+			{
+				const vec3d_pd v{ next_gen.velocity[i].value };
+
+				_block.vx[i] = v.x();
+				_block.vy[i] = v.y();
+				_block.vz[i] = v.z();
+			}
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					if constexpr (method == integration_method::hermite4)
+					{
+						const auto pull{ iterate_gravity_forces_active_hermite(i, next_gen) };
+
+						prev0_gen.gravity_acceleration[i] = acc3d{ pull.acc };
+						_block.jerk[i] = pull.jerk;
+
+						// no higher derivatives yet to go by
+						const double dt{ HERMITE_ETA_START * pull.acc.modulo() / pull.jerk.modulo() };
+
+						_block.level[i] = block_steps::level_for(dt, _time_delta);
+					}
+					else
+					{
+						const auto pull{ iterate_gravity_forces_active(i, next_gen) };
+
+						prev0_gen.gravity_acceleration[i] = acc3d{ pull.acc };
+						_block.level[i] = block_level(i, pull, next_gen);
+					}
+				});
+		}
+
+		//
+		// Correction of the active body i over its step dt, from its state in prev0_gen and the predictions in
+		// next_gen, into prev0_gen. Returns the level the body asks for next.
+		//
+		// block_steps: second order, integrates the acceleration interpolated linearly over the step, the derivative
+		// of the acceleration is estimated from the difference, and the step follows the nearest encounter.
+		//
+		// hermite4: fourth order Hermite corrector (Makino & Aarseth 1992) with the jerks evaluated by the kernel at
+		// both ends, and the Aarseth step criterion from the 2nd and 3rd derivatives of the acceleration that the
+		// corrector interpolates
+		//
+		int correct_block_body(int i, mass_bodies& prev0_gen, const mass_bodies& next_gen, double dt) noexcept
+		{
+			auto state{ prev0_gen.get_state(i) };
+
+			const vec3d_pd a0{ state.gravity_acceleration.value };
+			const vec3d_pd v0{ state.velocity.value };
+
+			if constexpr (method == integration_method::hermite4)
+			{
+				const auto pull{ iterate_gravity_forces_active_hermite(i, next_gen) };
+
+				const vec3d_pd& a1{ pull.acc };
+				const vec3d_pd& j0{ _block.jerk[i] };
+				const vec3d_pd& j1{ pull.jerk };
+
+				state.velocity = state.velocity + ((a0 + a1) * 0.5 + (j0 - j1) * (dt / 12.0)) * dt;
+				state.location = state.location + ((v0 + state.velocity.value) * 0.5 + (a0 - a1) * (dt / 12.0)) * dt;
+				state.gravity_acceleration = acc3d{ pull.acc };
+
+				prev0_gen.set_state(i, state);
+				_block.jerk[i] = pull.jerk;
+
+				const double dt2{ dt * dt };
+				const vec3d_pd a3{ ((a0 - a1) * 12.0 + (j0 + j1) * (6.0 * dt)) / (dt2 * dt) };
+				const vec3d_pd a2{ ((a1 - a0) * 6.0 - (j0 * 4.0 + j1 * 2.0) * dt) / dt2 + a3 * dt };
+
+				const double acc{ a1.modulo() };
+				const double jerk{ j1.modulo() };
+				const double snap{ a2.modulo() };
+				const double crackle{ a3.modulo() };
+
+				return block_steps::level_for(std::sqrt(HERMITE_ETA * (acc * snap + jerk * jerk) / (jerk * crackle + snap * snap)), _time_delta);
+			}
+			else
+			{
+				const auto pull{ iterate_gravity_forces_active(i, next_gen) };
+
+				state.location = state.location + (v0 + (a0 * 2.0 + pull.acc) * (dt / 6.0)) * dt;
+				state.velocity = state.velocity + (a0 + pull.acc) * (dt * 0.5);
+				state.gravity_acceleration = acc3d{ pull.acc };
+
+				prev0_gen.set_state(i, state);
+				_block.jerk[i] = (pull.acc - a0) / dt;
+
+				return block_level(i, pull, next_gen);
+			}
+		}
+
+		//
+		// Acceleration of a single body from the locations of all the others in gen
+		//
+		block_pull iterate_gravity_forces_active(int i, const mass_bodies& gen) noexcept
+		{
+			return block_active_pull(
+				i,
+				static_cast<int>(gen.size()),
+				gen.x.data(),
+				gen.y.data(),
+				gen.z.data(),
+				_props.mass_G.data(),
+				_props.radius.data(),
+				[&](int i, int j) { register_collisions(i, j); },
+				[&](int i) { _props.temperature[i] = std::max(_props.temperature[i], 1000.0); }); // tidal forces stirr the mantel, floor is lava in the whole planet now
+		}
+
+		//
+		// Acceleration and jerk of a single body from the locations in gen and the velocities predicted with them
+		//
+		hermite_pull iterate_gravity_forces_active_hermite(int i, const mass_bodies& gen) noexcept
+		{
+			return hermite_active_pull(
+				i,
+				static_cast<int>(gen.size()),
+				gen.x.data(),
+				gen.y.data(),
+				gen.z.data(),
+				_block.vx.data(),
+				_block.vy.data(),
+				_block.vz.data(),
+				_props.mass_G.data(),
+				_props.radius.data(),
+				[&](int i, int j) { register_collisions(i, j); },
+				[&](int i) { _props.temperature[i] = std::max(_props.temperature[i], 1000.0); }); // tidal forces stirr the mantel, floor is lava in the whole planet now
+		}
+
+		//
+		// Level for the time scale of the nearest encounter: the free fall time under the current pull, or the time
+		// to cover the distance at the relative velocity, whichever is shorter
+		//
+		int block_level(int i, const block_pull& pull, const mass_bodies& gen) const noexcept
+		{
+			if (pull.nearest < 0)
+				return 0;
+
+			const double r{ std::sqrt(pull.nearest_r2) };
+			const double relative_speed{ (gen.velocity[pull.nearest].value - gen.velocity[i].value).modulo() };
+
+			const double free_fall{ std::sqrt(r / pull.acc.modulo()) };
+			const double crossing{ r / relative_speed };
+
+			return block_steps::level_for(BLOCK_ETA * std::min(free_fall, crossing), _time_delta);
+		}
+
+		//
+		// Multiple time stepping with impulses (RESPA): the far pairs kick the velocities by half of time_delta at
+		// both ends of the step, in between the near pairs are stepped by leapfrog in _split.substeps() substeps. The
+		// far forces, which are almost all of the pairs, are thus evaluated once per time_delta, the near ones per
+		// substep, see force_split for what is near.
+		//
+		// Both kinds of the accelerations at the end are kept for the next step, as long as the split stays the same
+		//
+		void iterate_respa(
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			const int substeps{ _split.substeps() };
+			const double h{ _time_delta / substeps };
+
+			const bool bodies_changed{ _split_far.size() != curr_gen.size() };
+
+			// the kept accelerations are split the old way when the bodies have moved between the subsystems
+			if (_split.assign_subsystems(static_cast<int>(curr_gen.size()), curr_gen.x.data(), curr_gen.y.data(), curr_gen.z.data(), _props.mass_G.data()) || bodies_changed)
+			{
+				iterate_split_far_forces(curr_gen);
+				iterate_split_near_forces(curr_gen);
+			}
+
+			next_gen = curr_gen;
+
+			split_kick(next_gen, _split_far, _time_delta * 0.5);
+
+			for (int substep = 0; substep < substeps; ++substep)
+			{
+				split_kick(next_gen, _split_near, h * 0.5);
+
+				_pool.parallel_for(0, static_cast<int>(next_gen.size()),
+					[&](int i)
+					{
+						next_gen.set_location(i, next_gen.location(i) + next_gen.velocity[i].value * h);
+					});
+
+				iterate_split_near_forces(next_gen);
+				split_kick(next_gen, _split_near, h * 0.5);
+			}
+
+			iterate_split_far_forces(next_gen);
+
+			if (_split.by_distance())
+			{
+				// the near lists were just redone
+				iterate_split_near_forces(next_gen);
+			}
+
+			split_kick(next_gen, _split_far, _time_delta * 0.5);
+
+			for (int i = 0; i < static_cast<int>(next_gen.size()); ++i)
+			{
+				next_gen.gravity_acceleration[i] = acc3d{ _split_near[i] + _split_far[i] };
+			}
+		}
+
+		void split_kick(mass_bodies& gen, const std::vector<vec3d_pd>& acc, double kick) noexcept
+		{
+			_pool.parallel_for(0, static_cast<int>(gen.size()),
+				[&](int i)
+				{
+					gen.velocity[i] = gen.velocity[i] + acc[i] * kick;
+				});
+		}
+
+		//
+		// The far share of all the pairs into _split_far, and the near lists for the substeps. The collisions and the
+		// tidal heating are found here too, as all the pairs are gone through
+		//
+		void iterate_split_far_forces(const mass_bodies& gen) noexcept
+		{
+			const int num_bodies{ static_cast<int>(gen.size()) };
+
+			_split_far.resize(num_bodies);
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					auto& near{ _split.near(i) };
+					near.clear();
+
+					const vec3d_pd location{ gen.location_value(i) };
+					const double ri{ _props.radius[i] };
+
+					vec3d_pd acc{ 0.0, 0.0, 0.0 };
+					bool tidal_heating{ false };
+
+					for (int j = 0; j < num_bodies; ++j)
+					{
+						if (j == i)
+							continue;
+
+						const vec3d_pd d{ gen.location_value(j) - location };
+						const double r{ d.modulo() };
+
+						if (_split.is_near(i, j, r))
+						{
+							near.push_back(j);
+						}
+
+						if (r > ri + _props.radius[j])
+						{
+							acc += d * ((1.0 - _split.near_weight(i, j, r)) * _props.mass_G[j] / (r * r * r));
+							tidal_heating |= r < ri * 10.0;
+						}
+						else
+						{
+							register_collisions(i, j);
+						}
+					}
+
+					if (tidal_heating)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
+
+					_split_far[i] = acc;
+				});
+		}
+
+		//
+		// The near share of the listed pairs into _split_near
+		//
+		void iterate_split_near_forces(const mass_bodies& gen) noexcept
+		{
+			const int num_bodies{ static_cast<int>(gen.size()) };
+
+			_split_near.resize(num_bodies);
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					const vec3d_pd location{ gen.location_value(i) };
+					const double ri{ _props.radius[i] };
+
+					vec3d_pd acc{ 0.0, 0.0, 0.0 };
+
+					for (const int j : _split.near(i))
+					{
+						const vec3d_pd d{ gen.location_value(j) - location };
+						const double r{ d.modulo() };
+
+						if (r > ri + _props.radius[j])
+						{
+							acc += d * (_split.near_weight(i, j, r) * _props.mass_G[j] / (r * r * r));
+						}
+						else
+						{
+							register_collisions(i, j);
+						}
+					}
+
+					_split_near[i] = acc;
+				});
+		}
+
+		//
+		// Hierarchical stepping of the subsystems (see subsystems): a planet and its moons go in their own centre of
+		// mass frame, where the coordinates are small, at substeps of their own, while their barycentre and the single
+		// bodies drift at time_delta. All the forces across the subsystems are impulses at both ends of the step, as in
+		// iterate_respa - the members feel the single bodies each on their own, which is the tidal correction, and
+		// the other subsystems through their barycentres only.
+		//
+		// The single bodies are thus stepped at the rate of the outer orbits, and the pairs across two subsystems are
+		// evaluated as a single pair. The subsystems are checked at the start of every step
+		//
+		void iterate_hierarchical(
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			const bool bodies_changed{ _external_acc.size() != curr_gen.size() };
+
+			// the kept accelerations are split the old way when the bodies have moved between the subsystems
+			if (_subsystems.assign(static_cast<int>(curr_gen.size()), curr_gen.x.data(), curr_gen.y.data(), curr_gen.z.data(), _props.mass_G.data()) || bodies_changed)
+			{
+				_internal_acc.assign(curr_gen.size(), { 0.0, 0.0, 0.0 });
+
+				iterate_external_forces(curr_gen);
+			}
+
+			next_gen = curr_gen;
+
+			split_kick(next_gen, _external_acc, _time_delta * 0.5);
+
+			const auto& groups{ _subsystems.groups() };
+
+			_pool.parallel_for(0, static_cast<int>(groups.size()),
+				[&](int g)
+				{
+					drift_subsystem(groups[g], next_gen);
+				});
+
+			_pool.parallel_for(0, static_cast<int>(next_gen.size()),
+				[&](int i)
+				{
+					if (_subsystems.group(i) < 0)
+					{
+						next_gen.set_location(i, next_gen.location(i) + next_gen.velocity[i].value * _time_delta);
+					}
+				});
+
+			iterate_external_forces(next_gen);
+
+			split_kick(next_gen, _external_acc, _time_delta * 0.5);
+
+			for (int i = 0; i < static_cast<int>(next_gen.size()); ++i)
+			{
+				next_gen.gravity_acceleration[i] = acc3d{ _external_acc[i] + _internal_acc[i] };
+			}
+		}
+
+		//
+		// The members of the subsystem over time_delta: leapfrog in the centre of mass frame with the forces within
+		// the subsystem, at substeps of HIERARCHY_ETA of the shortest orbit around the primary. The barycentre drifts
+		//
+		void drift_subsystem(const std::vector<int>& members, mass_bodies& gen) noexcept
+		{
+			const int n{ static_cast<int>(members.size()) };
+
+			double mass_G{ 0.0 };
+			vec3d_pd barycentre{ 0.0, 0.0, 0.0 };
+			vec3d_pd barycentre_velocity{ 0.0, 0.0, 0.0 };
+
+			for (const int i : members)
+			{
+				mass_G += _props.mass_G[i];
+				barycentre += gen.location_value(i) * _props.mass_G[i];
+				barycentre_velocity += gen.velocity[i].value * _props.mass_G[i];
+			}
+
+			barycentre = barycentre / mass_G;
+			barycentre_velocity = barycentre_velocity / mass_G;
+
+			// in the arena of the worker the subsystem went to
+			arena_vector<vec3d_pd> location(n, arena_allocator<vec3d_pd>{ scratch() });
+			arena_vector<vec3d_pd> velocity(n, arena_allocator<vec3d_pd>{ scratch() });
+			arena_vector<vec3d_pd> acc(n, arena_allocator<vec3d_pd>{ scratch() });
+
+			double shortest_orbit{ std::numeric_limits<double>::infinity() };
+
+			for (int k = 0; k < n; ++k)
+			{
+				location[k] = gen.location_value(members[k]) - barycentre;
+				velocity[k] = gen.velocity[members[k]].value - barycentre_velocity;
+
+				if (k > 0)
+				{
+					const double r{ (location[k] - location[0]).modulo() };
+					shortest_orbit = std::min(shortest_orbit, std::sqrt(r * r * r / mass_G));
+				}
+			}
+
+			const int substeps{ static_cast<int>(std::clamp(std::ceil(_time_delta / (HIERARCHY_ETA * shortest_orbit)), 1.0, static_cast<double>(HIERARCHY_MAX_SUBSTEPS))) };
+			const double h{ _time_delta / substeps };
+
+			auto internal_forces = [&]()
+			{
+				for (int k = 0; k < n; ++k)
+				{
+					acc[k] = { 0.0, 0.0, 0.0 };
+				}
+
+				for (int k = 0; k < n; ++k)
+				{
+					const int i{ members[k] };
+
+					for (int l = k + 1; l < n; ++l)
+					{
+						const int j{ members[l] };
+
+						const vec3d_pd d{ location[l] - location[k] };
+						const double r{ d.modulo() };
+
+						if (r > _props.radius[i] + _props.radius[j])
+						{
+							const vec3d_pd f{ d / (r * r * r) };
+
+							acc[k] += f * _props.mass_G[j];
+							acc[l] -= f * _props.mass_G[i];
+
+							if (r < _props.radius[i] * 10.0)
+							{
+								_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+							}
+
+							if (r < _props.radius[j] * 10.0)
+							{
+								_props.temperature[j] = std::max(_props.temperature[j], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+							}
+						}
+						else
+						{
+							register_collisions(i, j);
+						}
+					}
+				}
+			};
+
+			internal_forces();
+
+			for (int substep = 0; substep < substeps; ++substep)
+			{
+				for (int k = 0; k < n; ++k)
+				{
+					velocity[k] += acc[k] * (h * 0.5);
+					location[k] += velocity[k] * h;
+				}
+
+				internal_forces();
+
+				for (int k = 0; k < n; ++k)
+				{
+					velocity[k] += acc[k] * (h * 0.5);
+				}
+			}
+
+			barycentre += barycentre_velocity * _time_delta;
+
+			for (int k = 0; k < n; ++k)
+			{
+				const int i{ members[k] };
+
+				gen.set_location(i, acc3d{ barycentre + location[k] });
+				gen.velocity[i] = acc3d{ barycentre_velocity + velocity[k] };
+				_internal_acc[i] = acc[k];
+			}
+		}
+
+		//
+		// The pulls across the subsystems into _external_acc: exact for the pairs with a single body, barycentre to
+		// barycentre for the pairs of two subsystems
+		//
+		void iterate_external_forces(const mass_bodies& gen) noexcept
+		{
+			const int num_bodies{ static_cast<int>(gen.size()) };
+			const auto& groups{ _subsystems.groups() };
+
+			_external_acc.resize(num_bodies);
+			_group_barycentres.resize(groups.size());
+			_group_mass_G.resize(groups.size());
+
+			for (size_t g = 0; g < groups.size(); ++g)
+			{
+				double mass_G{ 0.0 };
+				vec3d_pd barycentre{ 0.0, 0.0, 0.0 };
+
+				for (const int i : groups[g])
+				{
+					mass_G += _props.mass_G[i];
+					barycentre += gen.location_value(i) * _props.mass_G[i];
+				}
+
+				_group_mass_G[g] = mass_G;
+				_group_barycentres[g] = barycentre / mass_G;
+			}
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					const int group{ _subsystems.group(i) };
+					const vec3d_pd location{ gen.location_value(i) };
+					const double ri{ _props.radius[i] };
+
+					vec3d_pd acc{ 0.0, 0.0, 0.0 };
+					bool tidal_heating{ false };
+
+					for (int j = 0; j < num_bodies; ++j)
+					{
+						if (j == i || (group >= 0 && _subsystems.group(j) >= 0))
+							continue;
+
+						const vec3d_pd d{ gen.location_value(j) - location };
+						const double r{ d.modulo() };
+
+						if (r > ri + _props.radius[j])
+						{
+							acc += d * (_props.mass_G[j] / (r * r * r));
+							tidal_heating |= r < ri * 10.0;
+						}
+						else
+						{
+							register_collisions(i, j);
+						}
+					}
+
+					if (group >= 0)
+					{
+						const vec3d_pd& own{ _group_barycentres[group] };
+
+						for (int g = 0; g < static_cast<int>(groups.size()); ++g)
+						{
+							if (g == group)
+								continue;
+
+							const vec3d_pd d{ _group_barycentres[g] - own };
+							const double r{ d.modulo() };
+
+							acc += d * (_group_mass_G[g] / (r * r * r));
+						}
+					}
+
+					if (tidal_heating)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
+
+					_external_acc[i] = acc;
+				});
+		}
+
+		//
+		// Leapfrog at time_delta, with the tight pairs regularised: a pair whose two body time scale is too short for
+		// time_delta (see find_ks_pairs) drifts as its centre of mass, and the relative motion goes through ks_drift
+		// with the pull of all the other bodies as the perturbation. The other bodies then only feel the two members
+		// at both ends of the step, as for any other pair, so a close encounter no longer needs a shorter time_delta.
+		//
+		// prev0_gen keeps the bodies at the start of the drift, the other bodies are taken along their linear drift
+		// from there for the perturbation. The pairs are found again after every step
+		//
+		void iterate_ks_regularized(
+			mass_bodies& prev0_gen,
+			mass_bodies& curr_gen,
+			mass_bodies& next_gen
+		) noexcept
+		{
+			if (_ks_total.size() != curr_gen.size())
+			{
+				iterate_ks_forces(curr_gen);
+				find_ks_pairs(curr_gen);
+			}
+
+			next_gen = curr_gen;
+
+			split_kick(next_gen, _external_acc, _time_delta * 0.5);
+
+			if (!_ks_pairs.empty())
+			{
+				prev0_gen = next_gen;
+
+				_pool.parallel_for(0, static_cast<int>(_ks_pairs.size()),
+					[&](int p)
+					{
+						drift_ks_pair(_ks_pairs[p].first, _ks_pairs[p].second, prev0_gen, next_gen);
+					});
 			}
-			else if constexpr (method == integration_method::quadratic)
+
+			_pool.parallel_for(0, static_cast<int>(next_gen.size()),
+				[&](int i)
+				{
+					if (_ks_partner[i] < 0)
+					{
+						next_gen.set_location(i, next_gen.location(i) + next_gen.velocity[i].value * _time_delta);
+					}
+				});
+
+			iterate_ks_forces(next_gen);
+			ks_external_forces(next_gen);
+
+			split_kick(next_gen, _external_acc, _time_delta * 0.5);
+
+			for (int i = 0; i < static_cast<int>(next_gen.size()); ++i)
 			{
-				iterate_quadratic(prev0, current, next);
+				next_gen.gravity_acceleration[i] = acc3d{ _ks_total[i] };
 			}
-			else if constexpr (method == integration_method::quadratic_kahan)
+
+			find_ks_pairs(next_gen);
+		}
+
+		//
+		// Pull of j onto i, none for the colliding pairs
+		//
+		inline vec3d_pd ks_pull(const mass_bodies& gen, int i, int j) const noexcept
+		{
+			const vec3d_pd d{ gen.location_value(j) - gen.location_value(i) };
+			const double r{ d.modulo() };
+
+			return r > _props.radius[i] + _props.radius[j] ? d * (_props.mass_G[j] / (r * r * r)) : vec3d_pd{ 0.0, 0.0, 0.0 };
+		}
+
+		//
+		// The pair i, j over time_delta from the start state: the centre of mass drifts, the relative motion goes
+		// through ks_drift
+		//
+		void drift_ks_pair(int i, int j, const mass_bodies& start, mass_bodies& gen) noexcept
+		{
+			const double mi{ _props.mass_G[i] };
+			const double mj{ _props.mass_G[j] };
+			const double mass_G{ mi + mj };
+
+			const vec3d_pd barycentre{ (start.location_value(i) * mi + start.location_value(j) * mj) / mass_G };
+			const vec3d_pd barycentre_velocity{ (start.velocity[i].value * mi + start.velocity[j].value * mj) / mass_G };
+
+			vec3d_pd x{ start.location_value(i) - start.location_value(j) };
+			vec3d_pd v{ start.velocity[i].value - start.velocity[j].value };
+
+			const int num_bodies{ static_cast<int>(start.size()) };
+
+			// pull of the others onto i less the one onto j, the others moving along their drift
+			auto perturbation = [&](double t, const vec3d_pd& relative) noexcept
+			{
+				const vec3d_pd centre{ barycentre + barycentre_velocity * t };
+				const vec3d_pd xi{ centre + relative * (mj / mass_G) };
+				const vec3d_pd xj{ centre - relative * (mi / mass_G) };
+
+				vec3d_pd acc{ 0.0, 0.0, 0.0 };
+
+				for (int k = 0; k < num_bodies; ++k)
+				{
+					if (k == i || k == j)
+						continue;
+
+					const vec3d_pd location{ start.location_value(k) + start.velocity[k].value * t };
+
+					const vec3d_pd di{ location - xi };
+					const vec3d_pd dj{ location - xj };
+					const double ri{ di.modulo() };
+					const double rj{ dj.modulo() };
+
+					if (ri > _props.radius[i] + _props.radius[k])
+					{
+						acc += di * (_props.mass_G[k] / (ri * ri * ri));
+					}
+
+					if (rj > _props.radius[j] + _props.radius[k])
+					{
+						acc -= dj * (_props.mass_G[k] / (rj * rj * rj));
+					}
+				}
+
+				return acc;
+			};
+
+			double min_r{ 0.0 };
+			ks_drift::apply(x, v, mass_G, _time_delta, perturbation, min_r);
+
+			if (!(min_r > _props.radius[i] + _props.radius[j]))
 			{
-				iterate_quadratic_kahan(prev0, current, next);
+				register_collisions(i, j);
 			}
-			else if constexpr (method == integration_method::cubic)
+
+			for (const int k : { i, j })
 			{
-				iterate_cubic(prev1, prev0, current, next);
+				if (min_r < _props.radius[k] * 10.0)
+				{
+					_props.temperature[k] = std::max(_props.temperature[k], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+				}
 			}
-			else if constexpr (method == integration_method::cubic_kahan)
+
+			const vec3d_pd centre{ barycentre + barycentre_velocity * _time_delta };
+
+			gen.set_location(i, acc3d{ centre + x * (mj / mass_G) });
+			gen.set_location(j, acc3d{ centre - x * (mi / mass_G) });
+			gen.velocity[i] = acc3d{ barycentre_velocity + v * (mj / mass_G) };
+			gen.velocity[j] = acc3d{ barycentre_velocity - v * (mi / mass_G) };
+		}
+
+		//
+		// Pull of all the bodies into _ks_total, and for each body the one of the shortest two body time scale. The
+		// collisions and the tidal heating are found here too
+		//
+		void iterate_ks_forces(const mass_bodies& gen) noexcept
+		{
+			const int num_bodies{ static_cast<int>(gen.size()) };
+
+			_ks_total.resize(num_bodies);
+			_ks_candidate.resize(num_bodies);
+
+			_pool.parallel_for(0, num_bodies,
+				[&](int i)
+				{
+					const vec3d_pd location{ gen.location_value(i) };
+					const double ri{ _props.radius[i] };
+
+					vec3d_pd acc{ 0.0, 0.0, 0.0 };
+					bool tidal_heating{ false };
+
+					int candidate{ -1 };
+					double fastest{ 0.0 };		// 1 / time scale^2
+
+					for (int j = 0; j < num_bodies; ++j)
+					{
+						if (j == i)
+							continue;
+
+						const vec3d_pd d{ gen.location_value(j) - location };
+						const double r{ d.modulo() };
+
+						if (r > ri + _props.radius[j])
+						{
+							const double inv_r3{ 1.0 / (r * r * r) };
+
+							acc += d * (_props.mass_G[j] * inv_r3);
+							tidal_heating |= r < ri * 10.0;
+
+							const vec3d_pd dv{ gen.velocity[j].value - gen.velocity[i].value };
+							const double rate{ std::max((_props.mass_G[i] + _props.mass_G[j]) * inv_r3, vec3d_pd::dot(dv, dv) / (r * r)) };
+
+							if (rate > fastest)
+							{
+								fastest = rate;
+								candidate = j;
+							}
+						}
+						else
+						{
+							register_collisions(i, j);
+						}
+					}
+
+					if (tidal_heating)
+					{
+						_props.temperature[i] = std::max(_props.temperature[i], 1000.0); // tidal forces stirr the mantel, floor is lava in the whole planet now
+					}
+
+					_ks_total[i] = acc;
+					_ks_candidate[i] = candidate;
+				});
+		}
+
+		//
+		// The pulls less the one of the partner into _external_acc. The members of a pair only get the pull onto their
+		// centre of mass, the difference is the perturbation of their relative motion that ks_drift has in full
+		//
+		void ks_external_forces(const mass_bodies& gen) noexcept
+		{
+			_external_acc.resize(gen.size());
+
+			for (int i = 0; i < static_cast<int>(gen.size()); ++i)
 			{
-				iterate_cubic_kahan(prev1, prev0, current, next);
+				_external_acc[i] = _ks_total[i];
 			}
-			else
+
+			for (const auto& [i, j] : _ks_pairs)
 			{
-				static_assert(false, "Invalid integration method");
+				const double mi{ _props.mass_G[i] };
+				const double mj{ _props.mass_G[j] };
+
+				const vec3d_pd acc{ ((_ks_total[i] - ks_pull(gen, i, j)) * mi + (_ks_total[j] - ks_pull(gen, j, i)) * mj) / (mi + mj) };
+
+				_external_acc[i] = acc;
+				_external_acc[j] = acc;
 			}
 		}
 
-		void iterate_forces_and_moves() noexcept
+		//
+		// The pairs to regularise: a body and its candidate, when time_delta is above 1 / KS_RESOLUTION of their two
+		// body time scale, and the others perturb their relative motion by less than KS_MAX_PERTURBATION of their own
+		// pull. The tightest pairs go first, a body is in one pair at most. Then the external pulls to match
+		//
+		void find_ks_pairs(const mass_bodies& gen)
 		{
-			auto p1_idx = (_current_iteration + NUM_GENERATIONS - 2) % NUM_GENERATIONS;
-			auto p0_idx = (p1_idx + 1) % NUM_GENERATIONS;
-			auto c_idx = (p0_idx + 1) % NUM_GENERATIONS;
-			auto n_idx = (c_idx + 1) % NUM_GENERATIONS;
+			const int num_bodies{ static_cast<int>(gen.size()) };
+			const double resolved{ 1.0 / (KS_RESOLUTION * _time_delta * KS_RESOLUTION * _time_delta) };
 
-			auto& prev1_gen = _bodies_gens[p1_idx];
-			auto& prev0_gen = _bodies_gens[p0_idx];
-			auto& curr_gen = _bodies_gens[c_idx];
-			auto& next_gen = _bodies_gens[n_idx];
-			
-			bool use_mt = (_mt_ticks_per_n_iter < _st_ticks_per_n_iter);
+			using tight_pair = std::pair<double, std::pair<int, int>>;
 
-			auto sub_iter{ _current_iteration % PERFORMANCE_PROFILING_CYCLE };
-			bool profiling_iter{ sub_iter < PERFORMANCE_PROFILING_N * 2 };
+			arena_vector<tight_pair> tight{ arena_allocator<tight_pair>{ scratch() } };
 
-			if (profiling_iter)
+			for (int i = 0; i < num_bodies; ++i)
 			{
-				if (sub_iter == 0)
+				const int j{ _ks_candidate[i] };
+
+				if (j < 0 || (j < i && _ks_candidate[j] == i))
+					continue;
+
+				const double r{ (gen.location_value(j) - gen.location_value(i)).modulo() };
+				const vec3d_pd dv{ gen.velocity[j].value - gen.velocity[i].value };
+				const double rate{ std::max((_props.mass_G[i] + _props.mass_G[j]) / (r * r * r), vec3d_pd::dot(dv, dv) / (r * r)) };
+
+				if (rate > resolved)
 				{
-					_st_ticks_per_n_iter = 0;
-					_mt_ticks_per_n_iter = 0;
+					tight.push_back({ -rate, { std::min(i, j), std::max(i, j) } });
 				}
-				use_mt = sub_iter < PERFORMANCE_PROFILING_N;
-			}			
+			}
 
-			uint64_t start = __rdtsc();
-			if (!use_mt || _current_iteration == 0)
-			{
-				iterate_gravity_forces(prev1_gen, prev0_gen, curr_gen, next_gen);
+			std::sort(tight.begin(), tight.end());
 
-				if (profiling_iter)
-					_st_ticks_per_n_iter += __rdtsc() - start;
-			}
-			else
+			_ks_pairs.clear();
+			_ks_partner.assign(num_bodies, -1);
+
+			for (const auto& [rate, pair] : tight)
 			{
-				concurrency::parallel_for(0, static_cast<int>(curr_gen.size()),
-					[&](int i)
-					{
-						iterate_gravity_forces_mt(prev1_gen, prev0_gen, curr_gen, next_gen, i);
-					});
+				const auto [i, j] { pair };
 
-				if (profiling_iter)
-					_mt_ticks_per_n_iter += __rdtsc() - start;
+				if (_ks_partner[i] >= 0 || _ks_partner[j] >= 0)
+					continue;
+
+				const vec3d_pd pull_ij{ ks_pull(gen, i, j) };
+				const vec3d_pd pull_ji{ ks_pull(gen, j, i) };
+
+				const vec3d_pd perturbation{ (_ks_total[i] - pull_ij) - (_ks_total[j] - pull_ji) };
+				const double own{ (pull_ij - pull_ji).modulo() };
+
+				if (perturbation.modulo() < KS_MAX_PERTURBATION * own)
+				{
+					_ks_pairs.push_back(pair);
+					_ks_partner[i] = j;
+					_ks_partner[j] = i;
+				}
 			}
 
+			ks_external_forces(gen);
 		}
 
 	public: 
@@ -710,19 +2703,39 @@ namespace gravity
 
 		}
 
+		// the worker threads are started right away, so the batch runs ask for their single thread up front
+		explicit gravity_struct(int num_worker_threads)
+			: _pool{ num_worker_threads }
+			, _num_worker_threads{ std::max(1, num_worker_threads) }
+		{
+		}
+
 		void set_simulation_start_in_epoch_time_millis(uint64_t value)
 		{
 			_simulation_start_in_epoch_time_millis = value;
 		}
 
+		//
+		// The bodies of zero mass go with the test particles
+		//
 		void register_body(const mass_body& body)
 		{
-			auto body_copy{ body };
-			body_copy.mass_G = body_copy.mass * GRAVITATIONAL_CONSTANT;
+			if (body.mass == 0.0)
+			{
+				_particles.push_back(body.location.value, body.velocity.value);
+				return;
+			}
+
 			for (auto& gen : _bodies_gens)
 			{
-				gen.push_back(body_copy);
+				gen.push_back({ body.location, body.velocity, body.gravity_acceleration });
 			}
+
+			_props.mass_G.push_back(body.mass * GRAVITATIONAL_CONSTANT);
+			_props.radius.push_back(body.radius);
+			_props.mass.push_back(body.mass);
+			_props.temperature.push_back(body.temperature);
+			_props.label.push_back(_props.labels.intern(body.label));
 		}
 
 		//// 
@@ -757,9 +2770,88 @@ namespace gravity
 		//	}
 		//}
 
-		const std::vector<mass_body>& get_bodies() const noexcept
+		//
+		// View of a single body: gathers the SoA storage of the given generation back into a mass_body
+		//
+		mass_body get_body(const mass_bodies& generation, int idx) const
+		{
+			mass_body body{};
+			get_body(generation, idx, body);
+			return body;
+		}
+
+		//
+		// Same as above, into an existing mass_body, so the label goes into the string it already has
+		//
+		void get_body(const mass_bodies& generation, int idx, mass_body& body) const
+		{
+			body.location = generation.location(idx);
+			body.velocity = generation.velocity[idx];
+			body.gravity_acceleration = generation.gravity_acceleration[idx];
+
+			body.radius = _props.radius[idx];
+			body.mass = _props.mass[idx];
+			body.mass_G = _props.mass_G[idx];
+			body.temperature = _props.temperature[idx];
+			_props.labels.text(_props.label[idx], body.label);
+		}
+
+		mass_body get_body(int idx) const
+		{
+			return get_body(get_generation(0), idx);
+		}
+
+		//
+		// Where the bodies went on the merges and escapes since the previous call, for the observers that follow a
+		// body by its index: remap[i] is the index now of the body that was at i, -1 when it's gone, and the bodies
+		// merged into another one go to the merge. Empty when no body was removed
+		//
+		std::vector<int> take_body_remap() noexcept
+		{
+			std::vector<int> remap;
+			remap.swap(_body_remap);
+			return remap;
+		}
+
+		size_t num_bodies() const noexcept
+		{
+			return _props.size();
+		}
+
+		size_t num_test_particles() const noexcept
+		{
+			return _particles.size();
+		}
+
+		//
+		// View of a single test particle as a body of zero mass, as they are given in the csv
+		//
+		mass_body get_test_particle(int idx) const
+		{
+			mass_body body{};
+
+			body.location = acc3d{ _particles.location(idx) };
+			body.velocity = acc3d{ _particles.velocity(idx) };
+			body.gravity_acceleration = acc3d{ vec3d_pd{ _particles.ax[idx], _particles.ay[idx], _particles.az[idx] } };
+
+			body.mass = 0.0;
+			body.mass_G = 0.0;
+
+			return body;
+		}
+
+		//
+		// All the bodies of the current generation, into the given array. Its elements are reused, so refreshing
+		// the same array every frame does not touch the heap once it has been through the largest labels
+		//
+		void get_bodies(std::vector<mass_body>& bodies) const
 		{
-			return get_generation(0);
+			bodies.resize(_props.size());
+
+			for (int idx = 0; idx < static_cast<int>(_props.size()); ++idx)
+			{
+				get_body(get_generation(0), idx, bodies[idx]);
+			}
 		}
 
 		void set_time_delta(double time_delta)
@@ -807,16 +2899,60 @@ namespace gravity
 
 			if (show_warning)
 			{
+#ifdef _WIN32
 				MessageBox(
 					NULL,
 					L"Warning: epoch times are inconsistent for objects in the input csv",
 					L"Warning",
 					MB_OK | MB_ICONHAND);
+#else
+				std::cerr << "Warning: epoch times are inconsistent for objects in the input csv" << std::endl;
+#endif
 			}
 
 			return true;
 		}
 
+		void set_num_worker_threads(int num_threads)
+		{
+			_num_worker_threads = std::max(1, num_threads);
+			_pool.resize(_num_worker_threads);
+			_contacts.resize(_pool.num_threads());
+			_arenas.resize(_pool.num_threads());
+			_placed_bodies = 0;
+		}
+
+		void set_force_kernel(force_kernel kernel)
+		{
+			_force_kernel = kernel;
+		}
+
+		void set_tile_shape(const tile_shape& shape)
+		{
+			_tile_shape = shape;
+		}
+
+		void set_force_engine(force_engine engine)
+		{
+			_force_engine = engine;
+		}
+
+		void set_tree_opening_angle(double theta)
+		{
+			_tree.set_opening_angle(theta);
+			_fmm.set_opening_angle(theta);
+		}
+
+		void set_fmm_order(int order)
+		{
+			_fmm.set_order(order);
+		}
+
+		void set_tree_quadrupole(bool quadrupole)
+		{
+			_tree.set_quadrupole(quadrupole);
+		}
+
 		void set_output_csv(std::string output_file)
 		{
 			_report_file = output_file;
@@ -827,6 +2963,24 @@ namespace gravity
 			_report_centre = report_centre;
 		}
 
+		// relative error per step of the adaptive methods
+		void set_tolerance(double tolerance)
+		{
+			_tolerance = tolerance;
+		}
+
+		void set_force_split(int substeps, double cutoff)
+		{
+			_split.configure(substeps, cutoff);
+			_split_far.clear();
+			_external_acc.clear();
+		}
+
+		void set_collision_interval(int steps)
+		{
+			_collision_interval = std::max(1, steps);
+		}
+
 		void set_report_every(uint64_t report_every)
 		{
 			_report_every_n_iterations = report_every;
@@ -839,7 +2993,19 @@ namespace gravity
 
 		bool iterate() noexcept
 		{
+			const double time_before{ simulation_time() };
+			const uint64_t allocations_before{ allocation_counter::count() };
+
+			_arenas.reset();
+
+			place_body_arrays();
+
 			iterate_forces_and_moves();
+
+			// the current and the next generation are still where they were before the step
+			iterate_broad_phase(get_generation(0), get_generation(1));
+			iterate_test_particles(get_generation(0), get_generation(1), is_adaptive(method) ? _simulation_time - time_before : _time_delta);
+
 			iterate_collision_merges();
 
 			if (_current_iteration % (16 * 1024) == 0)
@@ -847,13 +3013,28 @@ namespace gravity
 
 			_current_iteration++;
 
-			if ((_report_every_n_iterations != 0 && (_current_iteration % _report_every_n_iterations) == 0) || 
-				(_current_iteration >= _max_iterations))
+			_step_allocations = allocation_counter::count() - allocations_before;
+
+			if constexpr (is_adaptive(method))
 			{
-				generate_report();
+				// the steps land exactly on these, see iterate_bulirsch_stoer
+				if (_simulation_time >= _next_report_time || _simulation_time >= end_time())
+				{
+					generate_report();
+				}
+
+				return _simulation_time < end_time();
 			}
+			else
+			{
+				if ((_report_every_n_iterations != 0 && (_current_iteration % _report_every_n_iterations) == 0) ||
+					(_current_iteration >= _max_iterations))
+				{
+					generate_report();
+				}
 
-			return _current_iteration < _max_iterations;
+				return _current_iteration < _max_iterations;
+			}
 		}
 
 		int64_t current_iteration() const noexcept
@@ -861,9 +3042,31 @@ namespace gravity
 			return _current_iteration;
 		}
 
+		//
+		// Heap allocations of the last step, not counting its report - 0 in the steady state, and always 0 unless the
+		// build counts them (see allocation_counter)
+		//
+		uint64_t step_allocations() const noexcept
+		{
+			return _step_allocations;
+		}
+
+		// simulated seconds since the start
+		double simulation_time() const noexcept
+		{
+			if constexpr (is_adaptive(method))
+			{
+				return _simulation_time;
+			}
+			else
+			{
+				return _current_iteration * _time_delta;
+			}
+		}
+
 		uint64_t current_time_epoch_millis() const noexcept
 		{
-			return _simulation_start_in_epoch_time_millis + static_cast<uint64_t>(std::round(_current_iteration * _time_delta * 1000.0));
+			return _simulation_start_in_epoch_time_millis + static_cast<uint64_t>(std::round(simulation_time() * 1000.0));
 		}
 
 		void generate_report()
@@ -887,26 +3090,38 @@ namespace gravity
 			vec3d_pd loc_centre{ 0.0, 0.0, 0.0 };
 			vec3d_pd vel_centre{ 0.0, 0.0, 0.0 };
 
-			for (const auto& body: current_gen)
+			const auto centre_label{ _props.labels.find(_report_centre) };
+
+			for (int idx = 0; idx < static_cast<int>(current_gen.size()); ++idx)
 			{
-				if (body.label == _report_centre)
+				if (_props.label[idx] == centre_label)
 				{
-					loc_centre = body.location.value;
-					vel_centre = body.velocity.value;
+					loc_centre = current_gen.location_value(idx);
+					vel_centre = current_gen.velocity[idx].value;
 					break;
 				}
 			}
 
 			uint64_t current_epoch_time{ current_time_epoch_millis() };
 
-			for (int idx = 0; idx < current_gen.size(); ++idx)
-			{
-				mass_body body_copy = current_gen[idx];
-				
-				body_copy.location.value -= loc_centre;
-				body_copy.velocity.value -= vel_centre;
+			// formatting the lines is the expensive part, so it is done in parallel, the file is written in order after.
+			// The test particles follow the bodies
+			const int num_bodies{ static_cast<int>(current_gen.size()) };
+			std::vector<std::string> lines(num_bodies + _particles.size());
 
-				auto line = body_copy.to_csv_line(_current_iteration, current_epoch_time, idx);
+			_pool.parallel_for(0, static_cast<int>(lines.size()),
+				[&](int idx)
+				{
+					mass_body body_copy = idx < num_bodies ? get_body(idx) : get_test_particle(idx - num_bodies);
+
+					body_copy.location.value -= loc_centre;
+					body_copy.velocity.value -= vel_centre;
+
+					lines[idx] = body_copy.to_csv_line(_current_iteration, current_epoch_time, idx);
+				});
+
+			for (const auto& line : lines)
+			{
 				ostrm << line << "\n";
 			}
 
@@ -922,13 +3137,39 @@ namespace gravity
 			uint32_t len = static_cast<uint32_t>(_bodies_gens[0].size());
 			stream.write(reinterpret_cast<const char*>(&len), sizeof(len));
 
-			for (auto& gen : _bodies_gens)
+			// the on-disk format is still a sequence of mass_body records per generation, in the slots of a 4-ring
+			for (int slot = 0; slot < SAVED_GENERATIONS; ++slot)
 			{
-				for (auto& b : gen)
+				const auto& gen{ get_generation(saved_generation_offset(slot)) };
+
+				for (int idx = 0; idx < static_cast<int>(len); ++idx)
 				{
-					b.save_to(stream);
+					get_body(gen, idx).save_to(stream);
 				}
 			}
+
+			// then the test particles, which the older files end before
+			const uint32_t num_particles{ static_cast<uint32_t>(_particles.size()) };
+			stream.write(reinterpret_cast<const char*>(&num_particles), sizeof(num_particles));
+
+			for (uint32_t p = 0; p < num_particles; ++p)
+			{
+				get_test_particle(p).save_to(stream);
+			}
+
+			// and the labels of the bodies, which the older files end before
+			for (uint32_t idx = 0; idx < len; ++idx)
+			{
+				const std::string label{ _props.labels.text(_props.label[idx]) };
+				const uint32_t label_len{ static_cast<uint32_t>(label.size()) };
+
+				stream.write(reinterpret_cast<const char*>(&label_len), sizeof(label_len));
+				stream.write(label.data(), label_len);
+			}
+
+			// and the simulated time, which the adaptive methods do not get from the iterations
+			const double time{ simulation_time() };
+			stream.write(reinterpret_cast<const char*>(&time), sizeof(time));
 		}
 
 		void load_from(std::istream& stream)
@@ -941,18 +3182,90 @@ namespace gravity
 			_time_delta_times_1_12 = _time_delta / 12.0;
 			_time_delta_times_1_24 = _time_delta / 24.0;
 
+			_adaptive_step = 0.0;
+			_block.resize(0);
+			_split_far.clear();
+			_external_acc.clear();
+			_ks_total.clear();
+			_collision_start_x.clear();
+			_body_remap.clear();
+			_placed_bodies = 0;
+
 			uint32_t len;
 			stream.read(reinterpret_cast<char*>(&len), sizeof(len));
 
+			_props.resize(len);
+			_props.labels.clear();
+
 			for (auto& gen : _bodies_gens)
 			{
 				gen.resize(len);
+			}
+
+			for (int slot = 0; slot < SAVED_GENERATIONS; ++slot)
+			{
+				const int offset{ saved_generation_offset(slot) };
+
+				// the past generations that the ring does not keep are read and dropped
+				const bool kept{ offset >= 2 - NUM_GENERATIONS };
+				auto& gen{ get_generation(offset) };
+
 				for (uint32_t i = 0; i < len; ++i)
 				{
-					gen[i] = {};
-					gen[i].load_from(stream);
+					mass_body body{};
+					body.load_from(stream);
+
+					if (kept)
+					{
+						gen.set_state(i, { body.location, body.velocity, body.gravity_acceleration });
+					}
+
+					if (offset == 0)
+					{
+						_props.mass_G[i] = body.mass_G;
+						_props.radius[i] = body.radius;
+						_props.mass[i] = body.mass;
+						_props.temperature[i] = body.temperature;
+					}
 				}
 			}
+
+			uint32_t num_particles{ 0 };
+			if (!stream.read(reinterpret_cast<char*>(&num_particles), sizeof(num_particles)))
+			{
+				num_particles = 0;
+			}
+
+			_particles.resize(0);
+
+			for (uint32_t p = 0; p < num_particles; ++p)
+			{
+				mass_body body{};
+				body.load_from(stream);
+
+				_particles.push_back(body.location.value, body.velocity.value);
+			}
+
+			std::fill(_props.label.begin(), _props.label.end(), label_table::NO_LABEL);
+
+			for (uint32_t idx = 0; idx < len; ++idx)
+			{
+				uint32_t label_len{ 0 };
+				if (!stream.read(reinterpret_cast<char*>(&label_len), sizeof(label_len)))
+					break;
+
+				std::string label(label_len, '\0');
+				if (!stream.read(label.data(), label_len))
+					break;
+
+				_props.label[idx] = _props.labels.intern(label);
+			}
+
+			// the older files end before it, their time_delta is then the mean step of the adaptive methods
+			if (!stream.read(reinterpret_cast<char*>(&_simulation_time), sizeof(_simulation_time)))
+			{
+				_simulation_time = _current_iteration * _time_delta;
+			}
 		}
 	};
 }
\ No newline at end of file
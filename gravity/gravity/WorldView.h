@@ -23,6 +23,7 @@ namespace gravity
 		double timeRate; // seconds of emulated time per second of a real time 
 		bool showDetailedcontrols;
 		bool paused;
+		uint64_t stepAllocations; // heap allocations of the last step, see allocation_counter
 
 		WorldViewDetails(int nThr, bool p) 
 			: numActiveThreads{ nThr }
@@ -30,6 +31,7 @@ namespace gravity
 			, timeRate{ 0 }
 			, showDetailedcontrols { false }
 			, paused { p }
+			, stepAllocations{ 0 }
 		{
 
 		}
@@ -108,6 +110,28 @@ namespace gravity
 			_current_focused_object--; // will deal with over/under-flows when updating view 
 		}
 
+		//
+		// Keeps the focus on the same body when the bodies before it merge or escape, see take_body_remap
+		//
+		void followFocusedObject(const std::vector<int>& remap)
+		{
+			if (remap.empty())
+				return;
+
+			const int focused_obj_modulo = static_cast<int>(remap.size()) + 1;
+			int focus = _current_focused_object;
+
+			while (focus < 0)
+				focus += focused_obj_modulo;
+			focus = (focus % focused_obj_modulo) - 1;
+
+			// an escaped body leaves the focus on the barycenter
+			if (focus != -1)
+			{
+				_current_focused_object = remap[focus] + 1;
+			}
+		}
+
 		void PrintControls(const WorldViewDetails& details) noexcept
 		{
 			glPushMatrix();
@@ -135,6 +159,11 @@ namespace gravity
 			
 			ostr << ", R: " << static_cast<int64_t>(details.timeRate / 1000) << "k:1";
 
+			if constexpr (allocation_counter::enabled)
+			{
+				ostr << ", A: " << details.stepAllocations;
+			}
+
 			std::ostringstream rcfg;
 			rcfg << "#THR: " << details.numActiveThreads;
 
@@ -242,6 +271,8 @@ namespace gravity
 				PrintControls(details);
 			}
 
+			followFocusedObject(world.take_body_remap());
+
 			const auto& objects = world.get_objects();
 			if (objects.size() > 0)
 			{
@@ -5,6 +5,8 @@
 #include "gravity.h"
 
 #include <atomic>
+#include <cstdlib>
+#include <new>
 #include <string>
 
 #include "RuntimeConfig.h"
@@ -12,14 +14,91 @@
 #include "World.h"
 #include "WorldView.h"
 #include "MainController.h"
+#include "BatchRunner.h"
 
 #include "Props.h"
 
 #include "PngLogger.h"
+#include "AllocationCounter.h"
 
 
 #define MAX_LOADSTRING 100
 
+#if defined(COUNT_ALLOCATIONS)
+
+//
+// Every heap allocation goes through here for gravity::allocation_counter. The aligned forms are separate from the
+// plain ones (std::vector<vec3d_pd> goes through them in the AVX builds), so both are replaced, each with its array,
+// sized and nothrow variants, and the aligned memory goes back the way it came
+//
+namespace
+{
+    void* counted_allocate(std::size_t size, std::size_t alignment) noexcept
+    {
+        gravity::allocation_counter::on_allocation();
+
+        size = size != 0 ? size : 1;
+
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return std::malloc(size);
+
+#ifdef _WIN32
+        return _aligned_malloc(size, alignment);
+#else
+        return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+    }
+
+    void counted_free(void* p, std::size_t alignment) noexcept
+    {
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            std::free(p);
+            return;
+        }
+
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    void* counted_new(std::size_t size, std::size_t alignment)
+    {
+        if (void* p = counted_allocate(size, alignment))
+            return p;
+
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(std::size_t size) { return counted_new(size, 0); }
+void* operator new[](std::size_t size) { return counted_new(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return counted_allocate(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return counted_allocate(size, 0); }
+
+void* operator new(std::size_t size, std::align_val_t al) { return counted_new(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return counted_new(size, static_cast<std::size_t>(al)); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return counted_allocate(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return counted_allocate(size, static_cast<std::size_t>(al)); }
+
+void operator delete(void* p) noexcept { counted_free(p, 0); }
+void operator delete[](void* p) noexcept { counted_free(p, 0); }
+void operator delete(void* p, std::size_t) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, std::size_t) noexcept { counted_free(p, 0); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_free(p, 0); }
+
+void operator delete(void* p, std::align_val_t al) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept { counted_free(p, static_cast<std::size_t>(al)); }
+
+#endif
+
 using TMainController = gravity::IMainController;
 
 std::unique_ptr<TMainController> controller;
@@ -311,6 +390,86 @@ HWND  CreateOpenGLWindow(const TCHAR* title, int x, int y, int width, int height
 }
 
 
+template <gravity::integration_method method>
+int RunBatch(const gravity::runtime_config& config)
+{
+    gravity::batch_settings settings;
+
+    settings.time_delta = config.time_delta();
+    settings.tolerance = config.tolerance();
+    settings.respa_substeps = config.respa_substeps();
+    settings.respa_cutoff = config.respa_cutoff();
+    settings.collision_interval = config.collision_interval();
+    settings.max_iterations = config.max_n();
+    settings.report_every_n = config.report_every_n();
+    settings.report_centre = config.report_centre();
+    settings.kernel = config.get_force_kernel();
+    settings.engine = config.get_force_engine();
+    settings.tree_opening_angle = config.tree_opening_angle();
+    settings.tree_quadrupole = config.tree_quadrupole();
+    settings.fmm_order = config.fmm_order();
+    settings.ensemble = config.batch_ensemble();
+
+    if (settings.kernel == gravity::force_kernel::tiled)
+    {
+        settings.tiles = gravity::tile_autotuner::load_or_tune(config.tile_cache_file());
+    }
+
+    gravity::batch_runner<method> runner{ config.num_worker_thrads() };
+    runner.set_settings(settings);
+
+    std::ostringstream errors;
+    if (!runner.load_manifest(config.batch_manifest(), errors))
+    {
+        MessageBoxA(NULL, errors.str().c_str(), "Invalid batch manifest", MB_OK | MB_ICONHAND);
+        return 1;
+    }
+
+    runner.run();
+    return 0;
+}
+
+int RunBatch(const gravity::runtime_config& config)
+{
+    switch (config.get_integration_method())
+    {
+    case gravity::integration_method::linear:
+        return RunBatch<gravity::integration_method::linear>(config);
+    case gravity::integration_method::linear_kahan:
+        return RunBatch<gravity::integration_method::linear_kahan>(config);
+    case gravity::integration_method::quadratic:
+        return RunBatch<gravity::integration_method::quadratic>(config);
+    case gravity::integration_method::quadratic_kahan:
+        return RunBatch<gravity::integration_method::quadratic_kahan>(config);
+    case gravity::integration_method::cubic:
+        return RunBatch<gravity::integration_method::cubic>(config);
+    case gravity::integration_method::cubic_kahan:
+        return RunBatch<gravity::integration_method::cubic_kahan>(config);
+    case gravity::integration_method::leapfrog:
+        return RunBatch<gravity::integration_method::leapfrog>(config);
+    case gravity::integration_method::yoshida4:
+        return RunBatch<gravity::integration_method::yoshida4>(config);
+    case gravity::integration_method::yoshida6:
+        return RunBatch<gravity::integration_method::yoshida6>(config);
+    case gravity::integration_method::wisdom_holman:
+        return RunBatch<gravity::integration_method::wisdom_holman>(config);
+    case gravity::integration_method::bulirsch_stoer:
+        return RunBatch<gravity::integration_method::bulirsch_stoer>(config);
+    case gravity::integration_method::block_steps:
+        return RunBatch<gravity::integration_method::block_steps>(config);
+    case gravity::integration_method::hermite4:
+        return RunBatch<gravity::integration_method::hermite4>(config);
+    case gravity::integration_method::respa:
+        return RunBatch<gravity::integration_method::respa>(config);
+    case gravity::integration_method::hierarchical:
+        return RunBatch<gravity::integration_method::hierarchical>(config);
+    case gravity::integration_method::ks_regularized:
+        return RunBatch<gravity::integration_method::ks_regularized>(config);
+    }
+
+    return 1;
+}
+
 int APIENTRY wWinMain(_In_ HINSTANCE hCurrentInst, _In_opt_ HINSTANCE hPreviousInst, _In_ LPWSTR lpszCmdLine, _In_ int nCmdShow)
 {
     gravity::runtime_config config;
@@ -320,6 +479,15 @@ int APIENTRY wWinMain(_In_ HINSTANCE hCurrentInst, _In_opt_ HINSTANCE hPreviousI
         return 0;
     }
 
+    // before any body is allocated
+    body_memory::configure(config.huge_pages(), config.first_touch());
+    OutputDebugStringA((body_memory::describe() + "\n").c_str());
+
+    if (!config.batch_manifest().empty())
+    {
+        return RunBatch(config);
+    }
+
     switch (config.get_integration_method())
     {
     case gravity::integration_method::linear:
@@ -351,6 +519,56 @@ int APIENTRY wWinMain(_In_ HINSTANCE hCurrentInst, _In_opt_ HINSTANCE hPreviousI
         controller = std::unique_ptr<TMainController>(
             new gravity::MainController<gravity::integration_method::cubic_kahan>(config));
         break;
+
+    case gravity::integration_method::leapfrog:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::leapfrog>(config));
+        break;
+
+    case gravity::integration_method::yoshida4:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::yoshida4>(config));
+        break;
+
+    case gravity::integration_method::yoshida6:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::yoshida6>(config));
+        break;
+
+    case gravity::integration_method::wisdom_holman:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::wisdom_holman>(config));
+        break;
+
+    case gravity::integration_method::bulirsch_stoer:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::bulirsch_stoer>(config));
+        break;
+
+    case gravity::integration_method::block_steps:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::block_steps>(config));
+        break;
+
+    case gravity::integration_method::hermite4:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::hermite4>(config));
+        break;
+
+    case gravity::integration_method::respa:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::respa>(config));
+        break;
+
+    case gravity::integration_method::hierarchical:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::hierarchical>(config));
+        break;
+
+    case gravity::integration_method::ks_regularized:
+        controller = std::unique_ptr<TMainController>(
+            new gravity::MainController<gravity::integration_method::ks_regularized>(config));
+        break;
     }
 
     controller->SetHWND(
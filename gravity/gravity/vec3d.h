@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <chrono>
@@ -11,6 +12,30 @@
 
 namespace gravity
 {
+	//
+	// Lane access of the intrinsic types: MSVC only exposes the lanes via its m256d_f64 / m128d_f64 unions,
+	// gcc and clang declare the types may_alias instead, so going through a double pointer works for both
+	//
+	inline double& lane(__m256d& v, int n) noexcept
+	{
+		return reinterpret_cast<double*>(&v)[n];
+	}
+
+	inline double lane(const __m256d& v, int n) noexcept
+	{
+		return reinterpret_cast<const double*>(&v)[n];
+	}
+
+	inline double& lane(__m128d& v, int n) noexcept
+	{
+		return reinterpret_cast<double*>(&v)[n];
+	}
+
+	inline double lane(const __m128d& v, int n) noexcept
+	{
+		return reinterpret_cast<const double*>(&v)[n];
+	}
+
 #if defined(AVX2)
 	struct vec3d_pd
 	{
@@ -34,32 +59,32 @@ namespace gravity
 
 		inline double x() const noexcept
 		{
-			return v.m256d_f64[0];
+			return lane(v, 0);
 		}
 
 		inline double y() const noexcept
 		{
-			return v.m256d_f64[1];
+			return lane(v, 1);
 		}
 
 		inline double z() const noexcept
 		{
-			return v.m256d_f64[2];
+			return lane(v, 2);
 		}
 
 		inline double& x() noexcept
 		{
-			return v.m256d_f64[0];
+			return lane(v, 0);
 		}
 
 		inline double& y() noexcept
 		{
-			return v.m256d_f64[1];
+			return lane(v, 1);
 		}
 
 		inline double& z() noexcept
 		{
-			return v.m256d_f64[2];
+			return lane(v, 2);
 		}
 
 		void save_to(std::ostream& stream) const
@@ -76,7 +101,7 @@ namespace gravity
 		{
 			//return std::sqrt(x() * x() + y() * y() + z() * z());
 			auto m = _mm256_mul_pd(v, v);
-			return std::sqrt(m.m256d_f64[0] + m.m256d_f64[1] + m.m256d_f64[2]);
+			return std::sqrt(lane(m, 0) + lane(m, 1) + lane(m, 2));
 		}
 
 		inline static vec3d_pd cross(const vec3d_pd& lhs, const vec3d_pd& rhs) noexcept
@@ -92,7 +117,7 @@ namespace gravity
 		inline static double dot(const vec3d_pd& lhs, const vec3d_pd& rhs) noexcept
 		{
 			auto m = _mm256_mul_pd(lhs.v, rhs.v);
-			return m.m256d_f64[0] + m.m256d_f64[1] + m.m256d_f64[2];
+			return lane(m, 0) + lane(m, 1) + lane(m, 2);
 		}
 
 		inline vec3d_pd& operator-=(const vec3d_pd& rhs) noexcept
@@ -163,32 +188,32 @@ namespace gravity
 
 		inline double x() const noexcept
 		{
-			return v0.m128d_f64[0];
+			return lane(v0, 0);
 		}
 
 		inline double y() const noexcept
 		{
-			return v0.m128d_f64[1];
+			return lane(v0, 1);
 		}
 
 		inline double z() const noexcept
 		{
-			return v1.m128d_f64[0];
+			return lane(v1, 0);
 		}
 
 		inline double& x() noexcept
 		{
-			return v0.m128d_f64[0];
+			return lane(v0, 0);
 		}
 
 		inline double& y() noexcept
 		{
-			return v0.m128d_f64[1];
+			return lane(v0, 1);
 		}
 
 		inline double& z() noexcept
 		{
-			return v1.m128d_f64[0];
+			return lane(v1, 0);
 		}
 
 		void save_to(std::ostream& stream) const
@@ -207,7 +232,7 @@ namespace gravity
 		{
 			//return std::sqrt(x() * x() + y() * y() + z() * z());
 			auto s = _mm_add_pd(_mm_mul_pd(v0, v0), _mm_mul_pd(v1, v1));
-			return std::sqrt(s.m128d_f64[0] + s.m128d_f64[1]);
+			return std::sqrt(lane(s, 0) + lane(s, 1));
 		}
 
 		inline static vec3d_pd cross(const vec3d_pd& lhs, const vec3d_pd& rhs) noexcept
@@ -223,7 +248,7 @@ namespace gravity
 		inline static double dot(const vec3d_pd& lhs, const vec3d_pd& rhs) noexcept
 		{
 			auto s = _mm_add_pd(_mm_mul_pd(lhs.v0, rhs.v0), _mm_mul_pd(lhs.v1, rhs.v1));
-			return s.m128d_f64[0] + s.m128d_f64[1];
+			return lane(s, 0) + lane(s, 1);
 		}
 
 		inline vec3d_pd& operator-=(const vec3d_pd& rhs) noexcept